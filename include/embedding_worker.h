@@ -0,0 +1,139 @@
+/*
+  Parker Cai
+  February 21, 2026
+  CS5330 - Project 3: Real-time 2-D Object Recognition
+
+  Asynchronous CNN embedding stage
+*/
+
+#ifndef EMBEDDING_WORKER_H
+#define EMBEDDING_WORKER_H
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/dnn.hpp>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include "or2d.h"
+
+/**
+  @brief Consumers that can ask for CNN embeddings (bit mask, see EmbeddingWorker::setDemand()).
+*/
+enum EmbeddingDemand : unsigned {
+  EMBED_FOR_DISPLAY = 1u << 0,  // CNN classification view
+  EMBED_FOR_TRAINING = 1u << 1, // saving CNN training samples
+  EMBED_FOR_EVAL = 1u << 2,     // CNN evaluation
+  EMBED_FOR_USER = 1u << 3      // first bit free for other result consumers
+};
+
+/**
+  @brief Runs the ResNet18 embeddings off the capture loop.
+  The loop submits one prepared crop (see prepEmbeddingInput()) per track and picks up
+  finished embeddings with collect(); the worker threads, each with its own network,
+  batch whatever is queued into one forward pass. The queue is bounded: a newer crop
+  replaces a pending one of the same track, and when full the oldest job is dropped.
+*/
+class EmbeddingWorker {
+public:
+  EmbeddingWorker() = default;
+  ~EmbeddingWorker();
+
+  EmbeddingWorker(const EmbeddingWorker&) = delete;
+  EmbeddingWorker& operator=(const EmbeddingWorker&) = delete;
+
+  /**
+    @brief Load one network per thread from modelPath and start the threads.
+    Throws cv::Exception if the model cannot be loaded (no thread is started then).
+    @param threads number of worker threads (each holds its own cv::dnn::Net)
+    @param maxQueue maximum number of pending crops
+  */
+  void start(const std::string& modelPath, int threads = 1, int maxQueue = 8);
+
+  /**
+    @brief Stop and join the worker threads; pending crops and results are dropped.
+  */
+  void stop();
+
+  /**
+    @brief True once start() has loaded the model.
+  */
+  bool ready() const { return !workers.empty(); }
+
+  /**
+    @brief Turn one consumer's (EmbeddingDemand bit) request for embeddings on or off.
+    When the last consumer turns off, pending crops and results are dropped, and batches
+    already running are not published.
+  */
+  void setDemand(unsigned consumer, bool on);
+
+  /**
+    @brief True if the model is loaded and some consumer wants embeddings.
+  */
+  bool demanded() const { return ready() && demand != 0; }
+
+  /**
+    @brief Start a new frame: the next embed() call does the work again.
+  */
+  void nextFrame() { frameId++; }
+
+  /**
+    @brief Submit the regions that still need an embedding and collect finished ones.
+    Runs at most once per frame (later calls are free) and only if demanded(), so any
+    consumer can call it right before it reads embeddingVector.
+  */
+  void embed(const cv::Mat& frame, std::vector<RegionInfo>& regions);
+
+  /**
+    @brief Queue a crop for a track (drop-oldest when the queue is full).
+  */
+  void submit(int trackId, const cv::Mat& crop);
+
+  /**
+    @brief Attach finished embeddings to the regions of their track.
+    A region gets its track's newest embedding if it has none yet or a newer one has
+    arrived (its cached CNN class id is cleared then). Results of tracks that are not
+    in regions are forgotten.
+  */
+  void collect(std::vector<RegionInfo>& regions);
+
+  /**
+    @brief Number of crops dropped because the queue was full.
+  */
+  uint64_t dropped() const;
+
+private:
+  struct Job {
+    int trackId;
+    cv::Mat crop;
+    uint64_t seq;
+  };
+  struct Result {
+    std::vector<float> embedding;
+    uint64_t seq = 0;
+    bool fresh = false;
+  };
+
+  void run(cv::dnn::Net net);
+
+  std::vector<std::thread> workers;
+  mutable std::mutex mtx;
+  std::condition_variable cond;
+  std::deque<Job> queue;
+  std::unordered_map<int, Result> results;
+  size_t maxQueue = 8;
+  size_t maxBatch = 8;
+  uint64_t nextSeq = 0;
+  uint64_t generation = 0; // bumped when pending work is dropped; older batches don't publish
+  uint64_t frameId = 0;
+  uint64_t embeddedFrame = UINT64_MAX;
+  unsigned demand = 0;
+  uint64_t numDropped = 0;
+  bool stopping = false;
+};
+
+#endif // EMBEDDING_WORKER_H
@@ -0,0 +1,123 @@
+/*
+  Parker Cai
+  February 22, 2026
+  CS5330 - Project 3: Real-time 2-D Object Recognition
+
+  HNSW approximate nearest-neighbor index for the CNN embedding DB
+*/
+
+#ifndef HNSW_INDEX_H
+#define HNSW_INDEX_H
+
+#include <vector>
+#include <string>
+#include <random>
+#include <utility>
+#include "or2d.h"
+
+/**
+  @brief Hierarchical Navigable Small World graph over CNN embeddings (squared L2).
+  Queries walk the graph instead of scanning the whole DB, so a DB of hundreds of
+  thousands of embeddings stays within a frame budget. Supports incremental add()
+  (e.g. the 'c' training key), a recall/latency knob (ef) and save()/load() so startup
+  does not rebuild the graph. While the DB has no more than ef embeddings queries are
+  an exact scan.
+*/
+class HnswIndex {
+public:
+  /**
+    @param M links per node per layer (2*M on the bottom layer)
+    @param efConstruction candidate list size while inserting (build quality)
+    @param ef candidate list size while searching (recall vs. latency)
+  */
+  explicit HnswIndex(int M = 16, int efConstruction = 200, int ef = 64);
+
+  void clear();
+
+  /**
+    @brief Rebuild from the training data (embeddings of another length than the first are skipped).
+  */
+  void build(const std::vector<std::string>& train_labels,
+    const std::vector<std::vector<float>>& train_features);
+
+  /**
+    @brief Insert one embedding; returns its id, or -1 if its length does not match the index.
+  */
+  int add(const std::string& label, const std::vector<float>& embedding);
+
+  bool empty() const { return labels.empty(); }
+  int size() const { return (int)labels.size(); }
+  int dims() const { return numDims; }
+  int label(int i) const { return labels[i]; } // classLabels() id
+
+  void setEf(int efSearch) { ef = efSearch < 1 ? 1 : efSearch; }
+  int getEf() const { return ef; }
+
+  /**
+    @brief Approximate k nearest neighbors as (SSD, id), closest first.
+  */
+  std::vector<std::pair<float, int>> search(const std::vector<float>& query, int k) const;
+
+  /**
+    @brief Approximate nearest embedding (-1 if none) and its SSD.
+  */
+  int nearest(const std::vector<float>& query, float& ssd) const;
+
+  /**
+    @brief Nearest-neighbor class id (LABEL_UNKNOWN if empty) and confidence 1 / (1 + SSD / dims).
+  */
+  int classify(const std::vector<float>& query, float& accuracy) const;
+
+  /**
+    @brief Write / read the graph (binary). load() returns false and leaves the index
+    empty if the file is missing or not an index file.
+  */
+  bool save(const std::string& filename) const;
+  bool load(const std::string& filename);
+
+  /**
+    @brief Load the graph from filename if it holds exactly the given training data,
+    otherwise rebuild it and save it there. Returns true if it was loaded.
+  */
+  bool loadOrBuild(const std::string& filename,
+    const std::vector<std::string>& train_labels,
+    const std::vector<std::vector<float>>& train_features);
+
+private:
+  typedef std::pair<float, int> DistId;
+
+  const float* vec(int id) const { return data.data() + (size_t)id * stride; }
+  float dist(const float* q, int id) const;
+  float dist(const float* q, int id, float bound) const; // may stop early once above bound
+  int greedyDescend(const float* q, int ep, int fromLevel, int toLevel) const;
+  std::vector<DistId> searchLayer(const float* q, const std::vector<DistId>& entry, int efLayer, int level) const;
+  std::vector<int> selectNeighbors(std::vector<DistId> candidates, int maxLinks) const;
+
+  int M;
+  int maxM0;
+  int efConstruction;
+  int ef;
+  double levelMult;
+  std::mt19937 rng;
+
+  int numDims = 0;
+  int stride = 0; // numDims rounded up to 16 floats
+  std::vector<float, AlignedAllocator<float>> data;
+  std::vector<int> labels; // classLabels() ids (names in the file)
+  std::vector<std::vector<std::vector<int>>> links; // links[id][level]
+  int entryPoint = -1;
+  int maxLevel = -1;
+};
+
+/**
+  @brief Nearest-neighbor CNN classification through the HNSW index.
+*/
+int classifyObjectCNN(const std::vector<float>& query,
+  const HnswIndex& index,
+  float& accuracy);
+
+void classifyAndLabelCNN(cv::Mat& image,
+  std::vector<RegionInfo>& regions,
+  const HnswIndex& index);
+
+#endif // HNSW_INDEX_H
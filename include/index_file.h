@@ -0,0 +1,24 @@
+/*
+  Parker Cai
+  February 22, 2026
+  CS5330 - Project 3: Real-time 2-D Object Recognition
+
+  Raw binary read / write helpers shared by the HNSW and PQ index files
+*/
+
+#ifndef INDEX_FILE_H
+#define INDEX_FILE_H
+
+#include <fstream>
+
+template <class T>
+void writePod(std::ofstream& out, const T& v) {
+  out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template <class T>
+bool readPod(std::ifstream& in, T& v) {
+  return (bool)in.read(reinterpret_cast<char*>(&v), sizeof(T));
+}
+
+#endif // INDEX_FILE_H
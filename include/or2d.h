@@ -12,13 +12,164 @@
 
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
 
-cv::Mat thresholdImage(const cv::Mat& input, int threshValue = -1);
+/**
+  @brief Stripe parallelism for the pixel kernels (thresholding, morphology, colorizeRegions).
+  Images are split into horizontal stripes run with cv::parallel_for_. Kernels that need
+  neighbor rows read a halo around their stripe, so results never depend on the split.
+  @param grainRows minimum rows per stripe
+  @param threads max stripes per call, 0 = cv::getNumThreads(), 1 = single-thread
+*/
+void setStripeParallelism(int grainRows, int threads = 0);
+int getStripeGrain();
+int getStripeThreads();
+
+/**
+  @brief Run body(rowBegin, rowEnd) over [0, rows) in parallel stripes.
+  @param grainRows minimum rows per stripe, -1 = the configured grain
+*/
+void parallelStripes(int rows, const std::function<void(int, int)>& body, int grainRows = -1);
+
+// Automatic threshold methods (used when threshValue < 0)
+enum AutoThreshMethod {
+  AUTO_THRESH_KMEANS = 0,    // k-means (k=2) on a 1/16 pixel sample, 3 attempts per frame
+  AUTO_THRESH_HISTOGRAM = 1, // ISODATA solved exactly on a 256-bin luminance histogram
+  AUTO_THRESH_LOCAL = 2,     // per-tile thresholds from an integral image (uneven lighting)
+};
+
+/**
+  @brief Threshold the input so dark objects become white (255) on a black background.
+  @param input grayscale or BGR image
+  @param threshValue fixed threshold, or -1 to compute one automatically
+  @param method automatic threshold method (AutoThreshMethod), ignored for a fixed threshold
+  @param lastThresh optional in/out warm start for AUTO_THRESH_HISTOGRAM: a valid value (0-255)
+         seeds the ISODATA iteration, and the threshold used for this frame is written back
+  @return binary image (CV_8U)
+*/
+cv::Mat thresholdImage(const cv::Mat& input, int threshValue = -1,
+  int method = AUTO_THRESH_HISTOGRAM, int* lastThresh = nullptr);
 
-cv::Mat cleanupBinary(const cv::Mat& binary);
+/**
+  @brief Two-cluster (ISODATA / 1-D k-means) threshold solved on a 256-bin histogram.
+  @param hist luminance histogram (256 bins)
+  @param warmStart initial threshold (e.g. previous frame's), or -1 to start from the mean
+  @return threshold t such that pixels < t belong to the dark cluster
+*/
+int histogramThreshold(const int hist[256], int warmStart = -1);
+
+/**
+  @brief Local (adaptive) threshold for uneven lighting.
+  Tile statistics come from an integral image, so the cost is O(pixels) for any window size.
+  Each tile gets a Sauvola threshold mean * (1 + k * (stddev / 128 - 1)) over a window centered
+  on the tile; low-contrast tiles borrow from their neighbors. Per-pixel thresholds are
+  bilinearly interpolated between tile centers, and tile rows are processed in parallel.
+  @param input grayscale or BGR image
+  @param tileSize approximate tile size in pixels
+  @param windowSize side of the statistics window centered on each tile (>= tileSize)
+  @param k Sauvola sensitivity (larger = stricter)
+  @return binary image (CV_8U)
+*/
+cv::Mat localThresholdImage(const cv::Mat& input, int tileSize = 64, int windowSize = 128, double k = 0.2);
+
+/**
+  @brief Opening then closing with square structuring elements.
+  @param binary input binary image (CV_8U, 0/255)
+  @param openSize side of the opening element (removes specks), <= 1 skips the opening
+  @param closeSize side of the closing element (fills holes), <= 1 skips the closing
+  @return cleaned binary image
+*/
+cv::Mat cleanupBinary(const cv::Mat& binary, int openSize = 3, int closeSize = 3);
+
+/**
+  @brief Same as above, writing into cleaned. The buffer is reused when it already has
+  the right size and type, so a caller that keeps it across frames allocates nothing.
+*/
+void cleanupBinary(const cv::Mat& binary, cv::Mat& cleaned, int openSize = 3, int closeSize = 3);
 cv::Mat erode(const cv::Mat& src);
 cv::Mat dilate(const cv::Mat& src);
 
+/**
+  @brief Erosion/dilation of a binary image (0/255) with a rectangular structuring element.
+  Use Size(k, k) for a square, Size(k, 1) for a horizontal line and Size(1, k) for a vertical line.
+  The anchor is the element center (k/2). Separable van Herk/Gil-Werman min/max filter:
+  about 3 compares per pixel per direction, whatever the element size.
+  Output pixels where the element does not fit inside the image are 0 (same rule as erode()).
+*/
+cv::Mat erodeRect(const cv::Mat& src, cv::Size ksize);
+cv::Mat dilateRect(const cv::Mat& src, cv::Size ksize);
+
+// Binary image packed 64 pixels per word: bit i of word w in a row is column 64*w + i.
+// Padding bits past the last column are always 0.
+struct PackedBinary {
+  int rows = 0;
+  int cols = 0;
+  int wordsPerRow = 0;
+  std::vector<uint64_t> words;
+
+  void create(int r, int c) {
+    rows = r;
+    cols = c;
+    wordsPerRow = (c + 63) / 64;
+    words.assign((size_t)rows * wordsPerRow, 0);
+  }
+  uint64_t* row(int r) { return words.data() + (size_t)r * wordsPerRow; }
+  const uint64_t* row(int r) const { return words.data() + (size_t)r * wordsPerRow; }
+};
+
+/**
+  @brief Pack a CV_8U binary image (nonzero = foreground) into 64-pixel words.
+*/
+void packBinary(const cv::Mat& src, PackedBinary& dst);
+
+/**
+  @brief Unpack to a CV_8U image with 255 for foreground and 0 for background.
+*/
+void unpackBinary(const PackedBinary& src, cv::Mat& dst);
+
+/**
+  @brief 3x3 erosion/dilation on packed rows with word-wide AND/OR and shifts.
+  Same results as erode()/dilate(): the 1-pixel image border is always 0.
+*/
+void erodePacked(const PackedBinary& src, PackedBinary& dst);
+void dilatePacked(const PackedBinary& src, PackedBinary& dst);
+
+/**
+  @brief Class names interned to dense integer ids (0, 1, 2, ...).
+  Indexes intern their labels when they are built or loaded; classification, the unknown
+  detector, the track cache and the confusion matrices then pass ids around, and names
+  are looked up only to draw or export them. Not thread-safe: use it from the frame loop.
+*/
+class LabelDictionary {
+public:
+  LabelDictionary();
+
+  int intern(const std::string& name);     // id of name, added if new
+  int find(const std::string& name) const; // LABEL_NONE if not interned
+  const std::string& name(int id) const;   // "" for LABEL_NONE or an id out of range
+  int size() const { return (int)names.size(); }
+
+private:
+  std::vector<std::string> names;
+  std::unordered_map<std::string, int> ids;
+};
+
+constexpr int LABEL_NONE = -1;    // not classified yet
+constexpr int LABEL_UNKNOWN = 0;  // "unknown": no training data to compare with
+constexpr int LABEL_REJECTED = 1; // "UNKNOWN": nearest neighbor below the confidence threshold
+
+/**
+  @brief The dictionary shared by all indexes and confusion matrices.
+*/
+LabelDictionary& classLabels();
+
 // Region info struct for storing segmentation results and features
 struct RegionInfo {
   int label;
@@ -37,6 +188,104 @@ struct RegionInfo {
   float vMin = 0, vMax = 0; // secondary axis extents
   // CNN embedding vector (512-d from ResNet18, use float for native DNN precision)
   std::vector<float> embeddingVector;
+  int trackId = -1; // stable ID across frames from RegionTracker, -1 when not tracked
+  // nearest-neighbor results as classLabels() ids, filled on demand by the classifiers
+  int classId = LABEL_NONE;    // hand-built features (before any unknown threshold)
+  double classConfidence = 0.0;
+  int cnnClassId = LABEL_NONE; // CNN embedding
+  float cnnConfidence = 0.0f;
+  bool cached = false; // features, embedding and class ids were reused from a TrackCache
+  // filled by the run-length labeling (CCL_METHOD_RLE), empty otherwise
+  cv::Moments moments; // spatial moments up to third order, with central/normalized moments
+  std::vector<cv::Vec3i> runs; // foreground runs: (row, first column, one past the last column)
+};
+
+// Oriented bounding box extents in computeRegionFeatures(), both give the same OBB
+enum ObbMethod {
+  OBB_METHOD_PIXELS = 0, // project the first and last pixel of every row of the region
+  OBB_METHOD_HULL = 1,   // project only the convex hull vertices of those pixels
+};
+
+// Connected components labeling used by segmentRegions()
+enum CclMethod {
+  CCL_METHOD_OPENCV = 0, // cv::connectedComponentsWithStats, features rescan the label map
+  CCL_METHOD_RLE = 1,    // run-length union-find, moments accumulated per run while labeling
+};
+
+/**
+  @brief Frame-to-frame region tracker: gives each region a track ID that stays the same
+  while the object moves less than maxMatchDist pixels between frames.
+  Owns all the tracking state, so each pipeline (camera, evaluation run, ...) has its own.
+*/
+class RegionTracker {
+public:
+  explicit RegionTracker(float maxMatchDist = 50.0f);
+
+  /**
+    @brief Optimal (Hungarian) assignment of regions to the previous frame's tracks on
+    centroid distance, gated at maxMatchDist. Sets region.trackId; unmatched regions
+    start new tracks.
+  */
+  void update(std::vector<RegionInfo>& regions);
+
+  /**
+    @brief Forget all tracks (e.g. when switching to another image set).
+  */
+  void reset();
+
+private:
+  struct Track {
+    int id;
+    cv::Point2f centroid;
+  };
+  std::vector<Track> tracks;
+  int nextId = 0;
+  float maxMatchDist;
+};
+
+/**
+  @brief Per-track cache of features, embeddings and class ids.
+  A tracked region whose area, centroid and orientation are within tolerance of its cached
+  values reuses them instead of being recomputed, so objects sitting still cost almost
+  nothing after their first frame. Every refreshFrames reuses the track is recomputed.
+  Usage per frame: segmentRegions(..., tracker) -> lookup() -> compute what is not cached
+  (computeAllRegionFeatures skips cached regions) -> classify -> store().
+*/
+class TrackCache {
+public:
+  float areaTol = 0.02f;    // max relative area change
+  float centroidTol = 1.5f; // max centroid shift (pixels)
+  float thetaTol = 0.02f;   // max orientation change (radians)
+  int refreshFrames = 30;   // recompute after this many reuses
+
+  /**
+    @brief Fill the regions that hit the cache and mark them region.cached.
+    Orientation comes from region.moments, so only run-length labeled regions can hit.
+    @return number of cache hits
+  */
+  int lookup(std::vector<RegionInfo>& regions);
+
+  /**
+    @brief Remember this frame's results; tracks that are gone are dropped.
+  */
+  void store(const std::vector<RegionInfo>& regions);
+
+  /**
+    @brief Forget everything (e.g. new CNN model).
+  */
+  void clear();
+
+  /**
+    @brief Forget only the class ids (training data changed); features stay cached.
+  */
+  void clearLabels();
+
+private:
+  struct Entry {
+    RegionInfo region;
+    int reuses;
+  };
+  std::vector<Entry> entries;
 };
 
 /**
@@ -46,20 +295,38 @@ struct RegionInfo {
   @param labelMap output label map (CV_32S) from connected components (region ID per pixel)
   @param minSize minimum area (in pixels) for a region to be considered valid (default 400 px = 20x20)
   @param maxRegions maximum number of regions to keep based on area (default 3)
-  @return Color-coded image with bounding boxes and centroids drawn for each detected region
+  @param cclMethod labeling method (CclMethod). With CCL_METHOD_RLE only the kept regions
+         are painted into labelMap, and each region carries its runs and moments
+  @return Color-coded image with bounding boxes and centroids drawn for each detected region.
+          Without a tracker, colors follow the area rank of the regions
 */
 cv::Mat segmentRegions(const cv::Mat& binary,
   std::vector<RegionInfo>& regions,
   cv::Mat& labelMap,
   int minSize = 400, // min: 20x20 pixels area
-  int maxRegions = 3); // max: 3 objects in the frame to recognize
+  int maxRegions = 3, // max: 3 objects in the frame to recognize
+  int cclMethod = CCL_METHOD_RLE);
+
+/**
+  @brief Same as above, with regions tracked across frames: tracker sets each region's
+  trackId, and the region color follows its track so it does not flicker.
+*/
+cv::Mat segmentRegions(const cv::Mat& binary,
+  std::vector<RegionInfo>& regions,
+  cv::Mat& labelMap,
+  RegionTracker& tracker,
+  int minSize = 400,
+  int maxRegions = 3,
+  int cclMethod = CCL_METHOD_RLE);
 
 /**
   @brief Compute features for a single region using region-based analysis.
   Computes principal axis, oriented bounding box, percent filled, aspect ratio,
-  Hu moments, and assembles a feature vector.
+  Hu moments, and assembles a feature vector. Regions from the run-length labeling
+  use their accumulated moments and runs and never touch the label map.
   @param labelMap integer label map (CV_32S) from connected components
   @param region RegionInfo struct to populate with computed features
+  @param obbMethod OBB extent method (ObbMethod), OBB_METHOD_HULL by default
 */
 /**
   @brief Build a color-coded region image without overlays (no AABB, no centroid).
@@ -69,7 +336,23 @@ cv::Mat segmentRegions(const cv::Mat& binary,
 */
 cv::Mat colorizeRegions(const cv::Mat& labelMap, const std::vector<RegionInfo>& regions);
 
-void computeRegionFeatures(const cv::Mat& labelMap, RegionInfo& region);
+/**
+  @brief Same as above, rendering into out (reused when it already has the right size and type).
+*/
+void colorizeRegions(const cv::Mat& labelMap, const std::vector<RegionInfo>& regions, cv::Mat& out);
+
+void computeRegionFeatures(const cv::Mat& labelMap, RegionInfo& region, int obbMethod = OBB_METHOD_HULL);
+
+/**
+  @brief Compute features for every region of a frame (same results as computeRegionFeatures).
+  Regions without runs share one sweep over the union of their bounding boxes.
+  Regions marked cached (TrackCache hit) are left as they are.
+  @param labelMap integer label map (CV_32S) from connected components
+  @param regions regions to populate with computed features
+  @param obbMethod OBB extent method (ObbMethod)
+*/
+void computeAllRegionFeatures(const cv::Mat& labelMap, std::vector<RegionInfo>& regions,
+  int obbMethod = OBB_METHOD_HULL);
 
 /**
   @brief Draw feature overlays (OBB, principal axis, feature text) on an image.
@@ -105,41 +388,331 @@ double scaledEuclideanDistance(const std::vector<double>& f1,
   const std::vector<double>& f2,
   const std::vector<double>& stddevs);
 
-std::string classifyObject(const std::vector<double>& query,
+/**
+  @brief Optional coarse stage of the exact nearest-neighbor indexes (class prototypes).
+  Each class is split into k-means sub-clusters (about sqrt(n) of them), each kept as a
+  center plus the radius that encloses its members. A query ranks the clusters by the
+  triangle-inequality bound |q - center| - radius and scans only the clusters (and within
+  them the members) that could still beat the best distance so far. The result is the
+  exact 1-NN of a linear scan, in sub-linear time when classes have many examples.
+*/
+class ClassPrototypes {
+public:
+  void clear();
+
+  /**
+    @brief Cluster the rows per class; labels[i] is the class id of row i.
+    @param rows labels.size() rows of dims values, stride values apart
+  */
+  void build(const std::vector<int>& labels, const double* rows, int dims, size_t stride);
+  void build(const std::vector<int>& labels, const float* rows, int dims, size_t stride);
+
+  bool empty() const { return radius.empty(); }
+  int count() const { return (int)radius.size(); }
+
+  /**
+    @brief Exact nearest row. rowSq(i, bound) returns the squared distance from query to row i
+    with the owning index's own kernel, or any value > bound once it is known to exceed the
+    best so far; ties go to the lowest row id, like a linear scan.
+    @return row id (-1 if none); sq gets rowSq() of it
+  */
+  template <class RowSq>
+  int nearest(const std::vector<double>& query, const RowSq& rowSq, double& sq) const;
+
+private:
+  // the bounds are exact, the distances come from float kernels: only prune clearly worse clusters
+  static constexpr double SLACK = 1e-3;
+
+  bool rankClusters(const std::vector<double>& query, std::vector<double>& toCenter,
+    std::vector<double>& bound, std::vector<int>& order) const;
+
+  int numDims = 0;
+  std::vector<double> centers;    // count() x numDims
+  std::vector<double> radius;     // max member distance to the center
+  std::vector<int> start;         // members of cluster p: members[start[p] .. start[p + 1])
+  std::vector<int> members;       // row ids, ascending within a cluster
+  std::vector<double> memberDist; // distance of each member to its center
+};
+
+/*
+  Clusters best bound first (rankClusters), until the bound exceeds the best distance.
+  A template so the index's row kernel inlines into the scan.
+*/
+template <class RowSq>
+int ClassPrototypes::nearest(const std::vector<double>& query, const RowSq& rowSq, double& sq) const {
+  sq = std::numeric_limits<double>::infinity();
+  std::vector<double> toCenter, bound;
+  std::vector<int> order;
+  if (!rankClusters(query, toCenter, bound, order)) return -1;
+
+  int best_idx = -1;
+  double limit = std::numeric_limits<double>::infinity(); // best distance plus slack
+  for (int p : order) {
+    if (bound[p] > limit) break;
+    for (int m = start[p]; m < start[p + 1]; m++) {
+      if (std::abs(toCenter[p] - memberDist[m]) > limit) continue;
+      const int id = members[m];
+      double d = rowSq(id, sq); // ties with sq still need the exact value
+      if (d < sq || (d == sq && id < best_idx)) {
+        sq = d;
+        best_idx = id;
+        limit = std::sqrt(sq) * (1.0 + SLACK);
+      }
+    }
+  }
+  return best_idx;
+}
+
+/**
+  @brief Nearest-neighbor index over the hand-built feature DB.
+  Built once when the DB is loaded or changed: keeps the per-dimension inverse standard
+  deviations and the training vectors pre-scaled by them in one contiguous row-major
+  matrix, so a query is one streamed pass over the matrix instead of recomputing the
+  standard deviations every time. Same results as the scaled Euclidean distance.
+*/
+class FeatureIndex {
+public:
+  FeatureIndex() = default;
+  FeatureIndex(const std::vector<std::string>& train_labels,
+    const std::vector<std::vector<double>>& train_features);
+
+  /**
+    @brief (Re)build from the training data. Vectors whose length differs from the
+    first one are left out (they could never match).
+  */
+  void build(const std::vector<std::string>& train_labels,
+    const std::vector<std::vector<double>>& train_features);
+
+  bool empty() const { return labels.empty(); }
+  int size() const { return (int)labels.size(); }
+  int dims() const { return numDims; }
+  int label(int i) const { return labels[i]; } // classLabels() id
+
+  /**
+    @brief Index of the nearest training vector (-1 if none) and its scaled Euclidean distance.
+  */
+  int nearest(const std::vector<double>& query, double& dist) const;
+
+  /**
+    @brief Nearest-neighbor class id (LABEL_UNKNOWN if empty) and accuracy 1 / (1 + distance).
+  */
+  int classify(const std::vector<double>& query, double& accuracy) const;
+
+  /**
+    @brief Search through ClassPrototypes (kept across build()) instead of a linear scan.
+    Same results; worth it once classes have many examples.
+  */
+  void setPruning(bool on);
+  bool pruning() const { return usePruning; }
+
+private:
+  std::vector<int> labels; // classLabels() ids
+  std::vector<double> invStd; // 1 / stddev per dimension
+  std::vector<double> scaled; // size() x dims(), features * invStd
+  int numDims = 0;
+  bool usePruning = false;
+  ClassPrototypes prototypes; // over the scaled rows
+};
+
+// Nearest-neighbor class id (resolve with classLabels().name())
+int classifyObject(const std::vector<double>& query,
   const std::vector<std::string>& train_labels,
   const std::vector<std::vector<double>>& train_features,
   double& accuracy);
+// Same through a prebuilt index (use this per frame)
+int classifyObject(const std::vector<double>& query,
+  const FeatureIndex& index,
+  double& accuracy);
 
 void classifyAndLabel(cv::Mat& image,
   std::vector<RegionInfo>& regions,
   const std::vector<std::string>& train_labels,
   const std::vector<std::vector<double>>& train_features);
+void classifyAndLabel(cv::Mat& image,
+  std::vector<RegionInfo>& regions,
+  const FeatureIndex& index);
 
 
 // Classification (CNN embedding - one-shot, uses float for native DNN precision)
 float sumOfSquaredDifference(const std::vector<float>& featuresA,
   const std::vector<float>& featuresB);
+// Same, but may stop once the partial sum exceeds bound (returns some value > bound then)
+float sumOfSquaredDifference(const std::vector<float>& featuresA,
+  const std::vector<float>& featuresB,
+  float bound);
+
+/**
+  @brief Squared L2 distance of two float arrays of length n.
+  Uses the widest SIMD kernel the CPU supports (AVX-512, AVX2+FMA, SSE), picked at runtime.
+*/
+float squaredL2(const float* a, const float* b, int n);
+
+/**
+  @brief squaredL2() that gives up once the partial sum exceeds bound (checked every 64 floats).
+  @return the same value as squaredL2() if that is <= bound, otherwise some value > bound
+*/
+float squaredL2Bounded(const float* a, const float* b, int n, float bound);
+
+/**
+  @brief Name of the squaredL2() kernel picked for this CPU ("avx512", "avx2", "sse" or "scalar").
+*/
+const char* squaredL2Kernel();
 
-std::string classifyObjectCNN(const std::vector<float>& query,
+/**
+  @brief Confidence of a CNN nearest neighbor, 1 / (1 + SSD / dims).
+*/
+float cnnConfidence(float ssd, int dims);
+
+/**
+  @brief Minimal allocator for 64-byte (cache line / AVX-512) aligned vectors.
+*/
+template <class T, size_t Align = 64>
+struct AlignedAllocator {
+  using value_type = T;
+  template <class U> struct rebind { using other = AlignedAllocator<U, Align>; };
+  AlignedAllocator() = default;
+  template <class U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+  T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align))); }
+  void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Align)); }
+  template <class U> bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+  template <class U> bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+};
+
+/**
+  @brief Row length of a dims-float embedding in the indexes: rounded up to 16 floats
+  (one AVX-512 register), so the kernels need no tail on the DB side.
+*/
+int embeddingStride(int dims);
+
+/**
+  @brief Aligned copy of an embedding, zero-padded to stride floats like the index rows.
+*/
+std::vector<float, AlignedAllocator<float>> paddedEmbedding(const std::vector<float>& embedding, int stride);
+
+/**
+  @brief Nearest-neighbor index over the CNN embedding DB.
+  All embeddings live in one 64-byte aligned row-major float matrix, each row zero-padded
+  to a multiple of 16 floats, and are scanned with squaredL2(). Build it once when the DB
+  is loaded or changed; same results as the SSD scan of classifyObjectCNN().
+*/
+class EmbeddingIndex {
+public:
+  EmbeddingIndex() = default;
+  EmbeddingIndex(const std::vector<std::string>& train_labels,
+    const std::vector<std::vector<float>>& train_features);
+
+  /**
+    @brief (Re)build from the training data. Embeddings whose length differs from the
+    first one are left out (they could never match).
+  */
+  void build(const std::vector<std::string>& train_labels,
+    const std::vector<std::vector<float>>& train_features);
+
+  bool empty() const { return labels.empty(); }
+  int size() const { return (int)labels.size(); }
+  int dims() const { return numDims; }
+  int label(int i) const { return labels[i]; } // classLabels() id
+  const float* row(int i) const { return data.data() + (size_t)i * stride; }
+
+  /**
+    @brief Index of the nearest embedding (-1 if none) and its SSD.
+  */
+  int nearest(const std::vector<float>& query, float& ssd) const;
+
+  /**
+    @brief Nearest-neighbor class id (LABEL_UNKNOWN if empty) and confidence 1 / (1 + SSD / dims).
+  */
+  int classify(const std::vector<float>& query, float& accuracy) const;
+
+  /**
+    @brief k nearest rows of every query at once, as (SSD, id) closest first. Distances to a
+    block of rows come from one cv::gemm as ||q||^2 + ||x||^2 - 2 q.x (row norms cached by
+    build()); every row within the expansion's round-off of the k-th best is re-scored with
+    squaredL2(), so the result is that of nearest(). Wrong-length queries get no results.
+  */
+  std::vector<std::vector<std::pair<float, int>>> searchBatch(
+    const std::vector<std::vector<float>>& queries, int k) const;
+
+  /**
+    @brief classify() of every query through searchBatch().
+  */
+  std::vector<int> classifyBatch(const std::vector<std::vector<float>>& queries,
+    std::vector<float>& accuracy) const;
+
+  /**
+    @brief Search through ClassPrototypes (kept across build()) instead of a linear scan.
+  */
+  void setPruning(bool on);
+  bool pruning() const { return usePruning; }
+
+  /**
+    @brief Pass the best distance so far into the kernel (squaredL2Bounded()) so rows that
+    can't win stop after a few blocks, in nearest() and in the re-score of searchBatch();
+    same neighbors and SSDs. With varianceOrder (off in the apps, not exact) the
+    columns are stored by decreasing variance (queries permuted to match) so the large
+    terms come first; SSDs then differ from the input order by float rounding only.
+    Kept across build().
+  */
+  void setEarlyAbandon(bool on, bool varianceOrder = false);
+  bool earlyAbandon() const { return useEarlyAbandon; }
+
+  /**
+    @brief Drop the DB and free its memory (settings are kept).
+  */
+  void clear();
+
+private:
+  std::vector<int> columnsByVariance() const;
+  void permuteColumns(const std::vector<int>& newOrder);
+  void storeQuery(const std::vector<float>& query, float* dst) const;
+
+  std::vector<int> labels; // classLabels() ids
+  std::vector<float, AlignedAllocator<float>> data; // size() x stride
+  std::vector<float> norms; // squared norm of each row, for searchBatch()
+  std::vector<int> order; // column k of data holds input dimension order[k] (empty: input order)
+  int numDims = 0;
+  int stride = 0; // numDims rounded up to 16 floats (one AVX-512 register)
+  bool usePruning = false;
+  bool useEarlyAbandon = false;
+  bool useVarianceOrder = false;
+  ClassPrototypes prototypes;
+};
+
+// Nearest-neighbor class id (resolve with classLabels().name())
+int classifyObjectCNN(const std::vector<float>& query,
   const std::vector<std::string>& train_labels,
   const std::vector<std::vector<float>>& train_features,
   float& accuracy);
+// Same through a prebuilt index (use this per frame)
+int classifyObjectCNN(const std::vector<float>& query,
+  const EmbeddingIndex& index,
+  float& accuracy);
 
 void classifyAndLabelCNN(cv::Mat& image,
   std::vector<RegionInfo>& regions,
   const std::vector<std::string>& train_labels,
   const std::vector<std::vector<float>>& train_features);
+void classifyAndLabelCNN(cv::Mat& image,
+  std::vector<RegionInfo>& regions,
+  const EmbeddingIndex& index);
 
+// Nearest-neighbor search over the CNN DB in the apps
+enum CnnSearch {
+  CNN_SEARCH_HNSW = 0,  // approximate graph search (HnswIndex)
+  CNN_SEARCH_PQ = 1,    // compressed codes, exact re-rank (PqIndex)
+  CNN_SEARCH_EXACT = 2, // all regions against the whole DB in one batch (EmbeddingIndex)
+};
 
-// Confusion matrix 
+
+// Confusion matrix over classLabels() ids, names are looked up when printing / saving
 struct ConfusionMatrix {
-  std::vector<std::string> classes;
-  std::map<std::string, int> class_index;
+  std::vector<int> classes;     // class id of each row / column, in order of appearance
+  std::vector<int> class_index; // row of each class id, -1 if not in the matrix
   std::vector<std::vector<int>> matrix;
 };
 
-void addClassToMatrix(ConfusionMatrix& cm, const std::string& name);
-void addResultToMatrix(ConfusionMatrix& cm, const std::string& true_label, const std::string& predicted);
+void addClassToMatrix(ConfusionMatrix& cm, int id);
+void addResultToMatrix(ConfusionMatrix& cm, int true_label, int predicted);
 void printConfusionMatrix(ConfusionMatrix& cm);
 void saveConfusionMatrix(ConfusionMatrix& cm, const std::string& filename);
 
@@ -148,17 +721,29 @@ bool isUnknownObject(const std::vector<double>& query,
                      const std::vector<std::string>& train_labels,
                      const std::vector<std::vector<double>>& train_features,
                      double threshold = 0.5);
+bool isUnknownObject(const std::vector<double>& query,
+                     const FeatureIndex& index,
+                     double threshold = 0.5);
 
-std::string classifyWithUnknown(const std::vector<double>& query,
-                                const std::vector<std::string>& train_labels,
-                                const std::vector<std::vector<double>>& train_features,
-                                double& confidence,
-                                double unknown_threshold = 0.5);
+// Class id, or LABEL_REJECTED if the confidence is below the threshold
+int classifyWithUnknown(const std::vector<double>& query,
+                        const std::vector<std::string>& train_labels,
+                        const std::vector<std::vector<double>>& train_features,
+                        double& confidence,
+                        double unknown_threshold = 0.5);
+int classifyWithUnknown(const std::vector<double>& query,
+                        const FeatureIndex& index,
+                        double& confidence,
+                        double unknown_threshold = 0.5);
 
 void classifyAndLabelWithUnknown(cv::Mat& image,
                                  std::vector<RegionInfo>& regions,
                                  const std::vector<std::string>& train_labels,
                                  const std::vector<std::vector<double>>& train_features,
                                  double unknown_threshold = 0.5);
+void classifyAndLabelWithUnknown(cv::Mat& image,
+                                 std::vector<RegionInfo>& regions,
+                                 const FeatureIndex& index,
+                                 double unknown_threshold = 0.5);
 
 #endif // OR2D_H
\ No newline at end of file
@@ -0,0 +1,123 @@
+/*
+  Parker Cai
+  February 22, 2026
+  CS5330 - Project 3: Real-time 2-D Object Recognition
+
+  Product-quantized (compressed) CNN embedding DB with asymmetric distance search
+*/
+
+#ifndef PQ_INDEX_H
+#define PQ_INDEX_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+#include "or2d.h"
+
+/**
+  @brief Product quantization of the CNN embeddings.
+  Each embedding is split into numSubspaces slices and every slice is replaced by the
+  id of its nearest of 256 k-means centroids, so a 512-d float embedding (2 KB) becomes
+  a numSubspaces-byte code (64 bytes by default, 32x smaller). A query builds one table
+  of slice-to-centroid distances (asymmetric distance), then the scan only adds table
+  entries per code. If the exact embeddings are at hand, the best candidates can be
+  re-ranked with the exact distance; only without re-ranking can the float DB be dropped.
+*/
+class PqIndex {
+public:
+  /**
+    @param numSubspaces bytes per code (the embedding is zero-padded to a multiple of it)
+    @param rerank number of candidates re-ranked exactly when exact embeddings are given
+  */
+  explicit PqIndex(int numSubspaces = 64, int rerank = 32);
+
+  void clear();
+
+  /**
+    @brief Train the codebooks (k-means per subspace on up to maxTrain embeddings) and
+    encode all embeddings. Embeddings of another length than the first are skipped.
+  */
+  void build(const std::vector<std::string>& train_labels,
+    const std::vector<std::vector<float>>& train_features,
+    int maxTrain = 20000);
+
+  /**
+    @brief Encode one more embedding with the existing codebooks.
+    @param row its row in the training data (for re-ranking), after every row added so far
+    @return its id, or -1 if the index is not trained, the length differs or row is not past the last one
+  */
+  int add(const std::string& label, const std::vector<float>& embedding, int row);
+
+  /**
+    @brief True once add() grew the index past the codebooks: they were trained with
+    fewer than 256 centroids (a small DB) and there are now more codes than centroids.
+    Rebuild then, or the approximate distances stop ranking the new codes.
+  */
+  bool stale() const;
+
+  bool empty() const { return labels.empty(); }
+  int size() const { return (int)labels.size(); }
+  int dims() const { return numDims; }
+  int codeSize() const { return numSubspaces; }
+  int label(int i) const { return labels[i]; } // classLabels() id
+
+  void setRerank(int r) { rerank = r < 0 ? 0 : r; }
+  int getRerank() const { return rerank; }
+
+  /**
+    @brief k nearest codes as (SSD, id), closest first. The SSD is approximate unless
+    exact (the training embeddings the index was built from) is given, then the best
+    max(k, rerank) candidates are re-ranked with the exact distance.
+  */
+  std::vector<std::pair<float, int>> search(const std::vector<float>& query, int k,
+    const std::vector<std::vector<float>>* exact = nullptr) const;
+
+  /**
+    @brief Nearest-neighbor class id (LABEL_UNKNOWN if empty) and confidence 1 / (1 + SSD / dims).
+  */
+  int classify(const std::vector<float>& query, float& accuracy,
+    const std::vector<std::vector<float>>* exact = nullptr) const;
+
+  /**
+    @brief Write / read codebooks, codes and labels (binary). load() returns false and
+    leaves the index empty if the file is missing or not a PQ file.
+  */
+  bool save(const std::string& filename) const;
+  bool load(const std::string& filename);
+
+  /**
+    @brief Load from filename if it was built from exactly the given training data
+    (labels and a hash of the embeddings), otherwise rebuild and save. Returns true if loaded.
+  */
+  bool loadOrBuild(const std::string& filename,
+    const std::vector<std::string>& train_labels,
+    const std::vector<std::vector<float>>& train_features);
+
+private:
+  void encode(const float* x, uint8_t* code) const;
+  void distanceTable(const std::vector<float>& query, std::vector<float>& table) const;
+
+  int numSubspaces;
+  int rerank;
+  int numDims = 0;
+  int subDims = 0;   // dims per subspace (after padding)
+  int numCentroids = 0; // per subspace, <= 256
+  std::vector<float> codebooks; // numSubspaces x numCentroids x subDims
+  std::vector<uint8_t> codes;   // size() x numSubspaces
+  std::vector<int> labels;      // classLabels() ids (names in the file)
+  std::vector<int> source;      // row of each code in the training data (for re-ranking)
+  uint64_t sourceHash = 0;      // FNV-1a of labels + embeddings, to match the CSV
+};
+
+int classifyObjectCNN(const std::vector<float>& query,
+  const PqIndex& index,
+  float& accuracy,
+  const std::vector<std::vector<float>>* exact = nullptr);
+
+void classifyAndLabelCNN(cv::Mat& image,
+  std::vector<RegionInfo>& regions,
+  const PqIndex& index,
+  const std::vector<std::vector<float>>* exact = nullptr);
+
+#endif // PQ_INDEX_H
@@ -26,6 +26,21 @@
 */
 int getEmbedding(cv::Mat &src, cv::Mat &embedding, cv::dnn::Net &net, int debug);
 
+/**
+  @brief Compute embedding vectors for several images in one forward pass.
+
+  All images are resized and packed into a single NCHW blob, so a frame with
+  N regions costs one ResNet18 forward pass instead of N. Falls back to one
+  pass per image if the network does not return one row per image.
+
+  @param srcs input images (8UC3 format, non-empty)
+  @param embeddings output matrix, one embedding per row in the order of srcs
+  @param net pre-trained ResNet 18 network loaded from ONNX model
+  @param debug if 1, print the embeddings; if 0, run silently
+  @return 0 on success
+*/
+int getEmbeddings(const std::vector<cv::Mat> &srcs, cv::Mat &embeddings, cv::dnn::Net &net, int debug);
+
 /**
   @brief Extract and rotate object region for embedding computation.
   
@@ -48,4 +63,28 @@ void prepEmbeddingImage(cv::Mat &frame, cv::Mat &embimage,
                         float minE1, float maxE1, 
                         float minE2, float maxE2, int debug);
 
+/**
+  @brief Prepare the network input for a region with a single affine warp.
+
+  Same ROI as prepEmbeddingImage(), but the rotation, crop and resize are
+  combined into one matrix and the frame is warped straight into a
+  size x size image: no full-frame rotated intermediate, no debug drawing.
+  The result can be passed to getEmbedding()/getEmbeddings() as is.
+
+  @param frame original image
+  @param embimage output network input image (size x size, empty if the ROI is empty)
+  @param cx x-coordinate of the region centroid
+  @param cy y-coordinate of the region centroid
+  @param theta orientation of the primary axis (in radians)
+  @param minE1 minimum projection along primary axis (should be negative)
+  @param maxE1 maximum projection along primary axis (should be positive)
+  @param minE2 minimum projection along secondary axis (should be negative)
+  @param maxE2 maximum projection along secondary axis (should be positive)
+  @param size output width and height (network input size)
+*/
+void prepEmbeddingInput(const cv::Mat &frame, cv::Mat &embimage,
+                        int cx, int cy, float theta,
+                        float minE1, float maxE1,
+                        float minE2, float maxE2, int size = 224);
+
 #endif // UTILITIES_H
@@ -9,6 +9,8 @@
 */
 
 #include "or2d.h"
+#include "hnsw_index.h"
+#include "pq_index.h"
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <string>
@@ -17,6 +19,7 @@
 
 constexpr double INF = std::numeric_limits<double>::infinity();
 constexpr float INF_F = std::numeric_limits<float>::infinity();
+constexpr int ABANDON_BLOCK = 4; // dims between early-abandon checks (4 doubles, one AVX2 register)
 
 /*
   Calculate standard deviations for each feature
@@ -72,40 +75,126 @@ double scaledEuclideanDistance(
   return std::sqrt(sum);
 }
 
-// Use nearest neighbor to find closest match 
-std::string classifyObject(const std::vector<double>& query,
-  const std::vector<std::string>& train_labels,
-  const std::vector<std::vector<double>>& train_features,
-  double& acccuracy) {
-  if (train_labels.empty()) {
-    acccuracy = 0.0;
-    return "unknown";
+/*
+  Build the classifier index: standard deviations once (same as computeStdDevs),
+  then every training vector multiplied by 1/stddev into one contiguous matrix.
+*/
+FeatureIndex::FeatureIndex(const std::vector<std::string>& train_labels,
+  const std::vector<std::vector<double>>& train_features) {
+  build(train_labels, train_features);
+}
+
+void FeatureIndex::build(const std::vector<std::string>& train_labels,
+  const std::vector<std::vector<double>>& train_features) {
+  labels.clear();
+  invStd.clear();
+  scaled.clear();
+  numDims = 0;
+  if (train_labels.empty() || train_features.empty()) return;
+
+  numDims = (int)train_features[0].size();
+  std::vector<std::vector<double>> rows;
+  rows.reserve(train_features.size());
+  for (size_t i = 0; i < train_features.size() && i < train_labels.size(); i++) {
+    if ((int)train_features[i].size() != numDims) continue; // never matches a query
+    rows.push_back(train_features[i]);
+    labels.push_back(classLabels().intern(train_labels[i]));
   }
 
-  // get standard deviations
-  std::vector<double> stds = computeStdDevs(train_features);
+  std::vector<double> stds = computeStdDevs(rows);
+  invStd.resize(numDims);
+  for (int k = 0; k < numDims; k++) {
+    invStd[k] = 1.0 / stds[k];
+  }
 
-  // find nearest neighbor
-  double min_dist = INF;
-  int best_idx = -1;
+  scaled.resize(rows.size() * numDims);
+  for (size_t i = 0; i < rows.size(); i++) {
+    double* dst = &scaled[i * numDims];
+    for (int k = 0; k < numDims; k++) {
+      dst[k] = rows[i][k] * invStd[k];
+    }
+  }
+  if (usePruning) prototypes.build(labels, scaled.data(), numDims, numDims);
+}
 
-  for (size_t i = 0; i < train_features.size(); i++) {
-    double dist = scaledEuclideanDistance(query, train_features[i], stds);
-    if (dist < min_dist) {
-      min_dist = dist;
-      best_idx = i;
+void FeatureIndex::setPruning(bool on) {
+  usePruning = on;
+  if (on) {
+    prototypes.build(labels, scaled.data(), numDims, numDims);
+  } else {
+    prototypes.clear();
+  }
+}
+
+/*
+  One streamed pass: scale the query once, then squared distances to the pre-scaled rows
+  (only the rows the class prototypes can't rule out, if pruning is on). A row stops
+  early once its partial sum is past the best so far; the sum is built in the same order
+  either way, so the result is unchanged.
+*/
+int FeatureIndex::nearest(const std::vector<double>& query, double& dist) const {
+  dist = INF;
+  if (labels.empty() || (int)query.size() != numDims) return -1;
+
+  std::vector<double> q(numDims);
+  for (int k = 0; k < numDims; k++) {
+    q[k] = query[k] * invStd[k];
+  }
+
+  auto rowSq = [&](int i, double bound) {
+    const double* row = &scaled[(size_t)i * numDims];
+    double sum = 0.0;
+    for (int k = 0; k < numDims; k++) {
+      double diff = q[k] - row[k];
+      sum += diff * diff;
+      if ((k + 1) % ABANDON_BLOCK == 0 && sum > bound) break;
+    }
+    return sum;
+  };
+
+  double min_sq = INF;
+  int best_idx = -1;
+  if (usePruning) {
+    best_idx = prototypes.nearest(q, rowSq, min_sq);
+  } else {
+    for (int i = 0; i < (int)labels.size(); i++) {
+      double sum = rowSq(i, min_sq);
+      if (sum < min_sq) {
+        min_sq = sum;
+        best_idx = i;
+      }
     }
   }
 
+  if (best_idx != -1) dist = std::sqrt(min_sq);
+  return best_idx;
+}
+
+int FeatureIndex::classify(const std::vector<double>& query, double& accuracy) const {
+  double min_dist;
+  int best_idx = nearest(query, min_dist);
   if (best_idx == -1) {
-    acccuracy = 0.0;
-    return "unknown";
+    accuracy = 0.0;
+    return LABEL_UNKNOWN;
   }
 
   // accuracy based on distance
-  acccuracy = 1.0 / (1.0 + min_dist);
+  accuracy = 1.0 / (1.0 + min_dist);
+  return labels[best_idx];
+}
 
-  return train_labels[best_idx];
+// Use nearest neighbor to find closest match (builds a one-off index)
+int classifyObject(const std::vector<double>& query,
+  const std::vector<std::string>& train_labels,
+  const std::vector<std::vector<double>>& train_features,
+  double& acccuracy) {
+  return FeatureIndex(train_labels, train_features).classify(query, acccuracy);
+}
+
+int classifyObject(const std::vector<double>& query,
+  const FeatureIndex& index,
+  double& accuracy) {
+  return index.classify(query, accuracy);
 }
 
 // Classify all regions and draw labels on image
@@ -113,18 +202,25 @@ void classifyAndLabel(cv::Mat& image,
   std::vector<RegionInfo>& regions,
   const std::vector<std::string>& train_labels,
   const std::vector<std::vector<double>>& train_features) {
-  if (train_labels.empty()) {
+  classifyAndLabel(image, regions, FeatureIndex(train_labels, train_features));
+}
+
+void classifyAndLabel(cv::Mat& image,
+  std::vector<RegionInfo>& regions,
+  const FeatureIndex& index) {
+  if (index.empty()) {
     cv::putText(image, "No training data", cv::Point(10, 60),
       cv::FONT_HERSHEY_SIMPLEX, 0.7, cv::Scalar(0, 0, 255), 2);
     return;
   }
 
   for (auto& region : regions) {
-    double acc;
-    std::string label = classifyObject(region.featureVector,
-      train_labels,
-      train_features,
-      acc);
+    // classify once per region, a track cache hit already has its class
+    if (region.classId == LABEL_NONE) {
+      region.classId = index.classify(region.featureVector, region.classConfidence);
+    }
+    const std::string& label = classLabels().name(region.classId);
+    double acc = region.classConfidence;
 
     // Position label below the OBB
     cv::Point2f corners[4];
@@ -165,14 +261,24 @@ float sumOfSquaredDifference(const std::vector<float>& featuresA,
   // Check for size mismatch
   if (featuresA.size() != featuresB.size()) return INF_F;
 
-  float sum = 0.0f;
+  // SIMD kernel (src/embedding_index.cpp)
+  return squaredL2(featuresA.data(), featuresB.data(), (int)featuresA.size());
+}
 
-  for (size_t i = 0; i < featuresA.size(); i++) {
-    // x*x is faster than pow(x, 2)
-    sum += (featuresA[i] - featuresB[i]) * (featuresA[i] - featuresB[i]);
-  }
+/*
+  Normalize SSD by dimensionality to get per-dimension average distance,
+  then convert to confidence score
+*/
+float cnnConfidence(float ssd, int dims) {
+  float avg_dist = ssd / dims;
+  return 1.0f / (1.0f + avg_dist);
+}
 
-  return sum;
+float sumOfSquaredDifference(const std::vector<float>& featuresA,
+  const std::vector<float>& featuresB,
+  float bound) {
+  if (featuresA.size() != featuresB.size()) return INF_F;
+  return squaredL2Bounded(featuresA.data(), featuresB.data(), (int)featuresA.size(), bound);
 }
 
 
@@ -180,20 +286,20 @@ float sumOfSquaredDifference(const std::vector<float>& featuresA,
   One-shot classification using CNN embeddings using SSD as distance metric.
   Uses float for native DNN precision.
 */
-std::string classifyObjectCNN(const std::vector<float>& query,
+int classifyObjectCNN(const std::vector<float>& query,
   const std::vector<std::string>& train_labels,
   const std::vector<std::vector<float>>& train_features,
   float& accuracy) {
   if (train_labels.empty() || query.empty()) {
     accuracy = 0.0f;
-    return "unknown";
+    return LABEL_UNKNOWN;
   }
 
   float min_dist = INF_F;
   int best_idx = -1;
 
   for (size_t i = 0; i < train_features.size(); i++) {
-    float dist = sumOfSquaredDifference(query, train_features[i]);
+    float dist = sumOfSquaredDifference(query, train_features[i], min_dist); // stops once it can't win
     if (dist < min_dist) {
       min_dist = dist;
       best_idx = i;
@@ -202,40 +308,78 @@ std::string classifyObjectCNN(const std::vector<float>& query,
 
   if (best_idx == -1) {
     accuracy = 0.0f;
-    return "unknown";
+    return LABEL_UNKNOWN;
   }
 
-  // Normalize SSD by dimensionality to get per-dimension average distance
-  float avg_dist = min_dist / query.size();
-  // then convert to confidence score
-  accuracy = 1.0f / (1.0f + avg_dist);
+  accuracy = cnnConfidence(min_dist, (int)query.size());
+
+  return classLabels().intern(train_labels[best_idx]);
+}
 
-  return train_labels[best_idx];
+int classifyObjectCNN(const std::vector<float>& query,
+  const EmbeddingIndex& index,
+  float& accuracy) {
+  return index.classify(query, accuracy);
 }
 
 
+/*
+  Classify the regions that have an embedding but no class yet
+  (a track cache hit already has its class), one query at a time
+*/
+template <class Index>
+static void classifyPendingCNN(std::vector<RegionInfo>& regions, const Index& index) {
+  for (auto& region : regions) {
+    if (!region.embeddingVector.empty() && region.cnnClassId == LABEL_NONE) {
+      region.cnnClassId = index.classify(region.embeddingVector, region.cnnConfidence);
+    }
+  }
+}
+
+/*
+  Exact index: all pending regions in one batch (one gemm per block of the DB)
+*/
+static void classifyPendingCNN(std::vector<RegionInfo>& regions, const EmbeddingIndex& index) {
+  std::vector<RegionInfo*> pending;
+  std::vector<std::vector<float>> queries;
+  for (auto& region : regions) {
+    if (!region.embeddingVector.empty() && region.cnnClassId == LABEL_NONE) {
+      pending.push_back(&region);
+      queries.push_back(region.embeddingVector);
+    }
+  }
+  if (pending.empty()) return;
+
+  std::vector<float> acc;
+  std::vector<int> ids = index.classifyBatch(queries, acc);
+  for (size_t i = 0; i < pending.size(); i++) {
+    pending[i]->cnnClassId = ids[i];
+    pending[i]->cnnConfidence = acc[i];
+  }
+}
+
 /*
   Classify all regions using CNN embeddings and draw labels on image.
   Uses cyan text to distinguish from hand-built feature classification (yellow).
+  Index is EmbeddingIndex (exact), HnswIndex or PqRerank (approximate).
 */
-void classifyAndLabelCNN(cv::Mat& image,
+template <class Index>
+static void labelRegionsCNN(cv::Mat& image,
   std::vector<RegionInfo>& regions,
-  const std::vector<std::string>& train_labels,
-  const std::vector<std::vector<float>>& train_features) {
-  if (train_labels.empty()) {
+  const Index& index) {
+  if (index.empty()) {
     cv::putText(image, "No CNN training data", cv::Point(10, 60),
       cv::FONT_HERSHEY_SIMPLEX, 0.7, cv::Scalar(0, 0, 255), 2);
     return;
   }
 
+  classifyPendingCNN(regions, index);
+
   for (auto& region : regions) {
     if (region.embeddingVector.empty()) continue;
 
-    float acc;
-    std::string label = classifyObjectCNN(region.embeddingVector,
-      train_labels,
-      train_features,
-      acc);
+    const std::string& label = classLabels().name(region.cnnClassId);
+    float acc = region.cnnConfidence;
 
     // Position label below the OBB
     cv::Point2f corners[4];
@@ -258,3 +402,55 @@ void classifyAndLabelCNN(cv::Mat& image,
       cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(255, 255, 0), 1);
   }
 }
+
+void classifyAndLabelCNN(cv::Mat& image,
+  std::vector<RegionInfo>& regions,
+  const std::vector<std::string>& train_labels,
+  const std::vector<std::vector<float>>& train_features) {
+  labelRegionsCNN(image, regions, EmbeddingIndex(train_labels, train_features));
+}
+
+void classifyAndLabelCNN(cv::Mat& image,
+  std::vector<RegionInfo>& regions,
+  const EmbeddingIndex& index) {
+  labelRegionsCNN(image, regions, index);
+}
+
+int classifyObjectCNN(const std::vector<float>& query,
+  const HnswIndex& index,
+  float& accuracy) {
+  return index.classify(query, accuracy);
+}
+
+void classifyAndLabelCNN(cv::Mat& image,
+  std::vector<RegionInfo>& regions,
+  const HnswIndex& index) {
+  labelRegionsCNN(image, regions, index);
+}
+
+/*
+  PqIndex with the exact embeddings it re-ranks against, for labelRegionsCNN()
+*/
+struct PqRerank {
+  const PqIndex& index;
+  const std::vector<std::vector<float>>* exact;
+
+  bool empty() const { return index.empty(); }
+  int classify(const std::vector<float>& query, float& accuracy) const {
+    return index.classify(query, accuracy, exact);
+  }
+};
+
+int classifyObjectCNN(const std::vector<float>& query,
+  const PqIndex& index,
+  float& accuracy,
+  const std::vector<std::vector<float>>* exact) {
+  return index.classify(query, accuracy, exact);
+}
+
+void classifyAndLabelCNN(cv::Mat& image,
+  std::vector<RegionInfo>& regions,
+  const PqIndex& index,
+  const std::vector<std::vector<float>>* exact) {
+  labelRegionsCNN(image, regions, PqRerank{ index, exact });
+}
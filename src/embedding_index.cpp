@@ -0,0 +1,525 @@
+/*
+  Parker Cai
+  February 21, 2026
+  CS5330 - Project 3: Real-time 2-D Object Recognition
+
+  CNN embedding DB as one aligned matrix, scanned with SIMD squared-L2 kernels
+  (AVX-512 / AVX2+FMA / SSE, picked at runtime)
+*/
+
+#include "or2d.h"
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <string>
+#include <limits>
+#include <queue>
+#include <numeric>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define OR2D_X86 1
+#include <immintrin.h>
+#endif
+
+// GCC/Clang need the ISA on the function to emit its intrinsics; MSVC allows them anywhere
+#if defined(OR2D_X86) && (defined(__GNUC__) || defined(__clang__))
+#define OR2D_TARGET(isa) __attribute__((target(isa)))
+#else
+#define OR2D_TARGET(isa)
+#endif
+
+constexpr int ROW_ALIGN = 16; // floats per AVX-512 register; rows are padded to this
+constexpr int BATCH_ROWS = 4096; // DB rows per gemm in searchBatch() (queries x BATCH_ROWS distances)
+constexpr int EARLY_BLOCK = 64;  // floats between early-abandon checks (2-8 SIMD steps)
+
+/*
+  Reference kernel (and the tail of the SIMD ones)
+*/
+static float l2Scalar(const float* a, const float* b, int n) {
+  float sum = 0.0f;
+  for (int i = 0; i < n; i++) {
+    float d = a[i] - b[i];
+    sum += d * d;
+  }
+  return sum;
+}
+
+/*
+  Early-abandon variants: same arithmetic in the same order, plus a check of the partial
+  sum every EARLY_BLOCK floats. The terms are >= 0 and rounding is monotone, so a partial
+  sum above bound means the full one is too; anything <= bound is bit-identical to the
+  plain kernel.
+*/
+static float l2BoundedScalar(const float* a, const float* b, int n, float bound) {
+  float sum = 0.0f;
+  for (int i = 0; i < n; i++) {
+    float d = a[i] - b[i];
+    sum += d * d;
+    if ((i + 1) % EARLY_BLOCK == 0 && sum > bound) return sum;
+  }
+  return sum;
+}
+
+#ifdef OR2D_X86
+
+// horizontal sums, shared by the plain and the early-abandon kernels so both round alike
+OR2D_TARGET("sse2")
+static inline float sumSse(__m128 acc0, __m128 acc1) {
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, _mm_add_ps(acc0, acc1));
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+OR2D_TARGET("avx2,fma")
+static inline float sumAvx2(__m256 acc0, __m256 acc1) {
+  __m256 acc = _mm256_add_ps(acc0, acc1);
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+
+/*
+  Two accumulators per kernel so consecutive adds don't wait on each other;
+  at 512-d the scan is bound by memory, not by the arithmetic.
+*/
+OR2D_TARGET("sse2")
+static float l2Sse(const float* a, const float* b, int n) {
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+  }
+  return sumSse(acc0, acc1) + l2Scalar(a + i, b + i, n - i);
+}
+
+OR2D_TARGET("sse2")
+static float l2BoundedSse(const float* a, const float* b, int n, float bound) {
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  int i = 0;
+  while (i + 8 <= n) {
+    const int end = std::min(n, i + EARLY_BLOCK);
+    for (; i + 8 <= end; i += 8) {
+      __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+      __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+    }
+    if (i + 8 <= n) {
+      float partial = sumSse(acc0, acc1);
+      if (partial > bound) return partial;
+    }
+  }
+  return sumSse(acc0, acc1) + l2Scalar(a + i, b + i, n - i);
+}
+
+OR2D_TARGET("avx2,fma")
+static float l2Avx2(const float* a, const float* b, int n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+    acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+    acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+  }
+  return sumAvx2(acc0, acc1) + l2Scalar(a + i, b + i, n - i);
+}
+
+OR2D_TARGET("avx2,fma")
+static float l2BoundedAvx2(const float* a, const float* b, int n, float bound) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  int i = 0;
+  while (i + 16 <= n) {
+    const int end = std::min(n, i + EARLY_BLOCK);
+    for (; i + 16 <= end; i += 16) {
+      __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+      __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+      acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+      acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    if (i + 16 <= n) {
+      float partial = sumAvx2(acc0, acc1);
+      if (partial > bound) return partial;
+    }
+  }
+  return sumAvx2(acc0, acc1) + l2Scalar(a + i, b + i, n - i);
+}
+
+OR2D_TARGET("avx512f")
+static float l2Avx512(const float* a, const float* b, int n) {
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+    acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+  }
+  if (i + 16 <= n) {
+    __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    i += 16;
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1)) + l2Scalar(a + i, b + i, n - i);
+}
+
+OR2D_TARGET("avx512f")
+static float l2BoundedAvx512(const float* a, const float* b, int n, float bound) {
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  int i = 0;
+  while (i + 32 <= n) {
+    const int end = std::min(n, i + EARLY_BLOCK);
+    for (; i + 32 <= end; i += 32) {
+      __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+      __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+      acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+      acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    if (i + 32 <= n) {
+      float partial = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+      if (partial > bound) return partial;
+    }
+  }
+  if (i + 16 <= n) {
+    __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+    i += 16;
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1)) + l2Scalar(a + i, b + i, n - i);
+}
+
+#endif // OR2D_X86
+
+typedef float (*L2Kernel)(const float*, const float*, int);
+typedef float (*L2BoundedKernel)(const float*, const float*, int, float);
+
+struct L2Dispatch {
+  L2Kernel fn;
+  L2BoundedKernel bounded;
+  const char* name;
+};
+
+/*
+  Pick the kernel once, from what OpenCV detected for this CPU (and OS support).
+*/
+static const L2Dispatch& l2Dispatch() {
+  static const L2Dispatch d = [] {
+#ifdef OR2D_X86
+    if (cv::checkHardwareSupport(CV_CPU_AVX_512F)) return L2Dispatch{ l2Avx512, l2BoundedAvx512, "avx512" };
+    if (cv::checkHardwareSupport(CV_CPU_AVX2) && cv::checkHardwareSupport(CV_CPU_FMA3)) return L2Dispatch{ l2Avx2, l2BoundedAvx2, "avx2" };
+    if (cv::checkHardwareSupport(CV_CPU_SSE2)) return L2Dispatch{ l2Sse, l2BoundedSse, "sse" };
+#endif
+    return L2Dispatch{ l2Scalar, l2BoundedScalar, "scalar" };
+  }();
+  return d;
+}
+
+float squaredL2(const float* a, const float* b, int n) {
+  return l2Dispatch().fn(a, b, n);
+}
+
+float squaredL2Bounded(const float* a, const float* b, int n, float bound) {
+  return l2Dispatch().bounded(a, b, n, bound);
+}
+
+const char* squaredL2Kernel() {
+  return l2Dispatch().name;
+}
+
+int embeddingStride(int dims) {
+  return (dims + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;
+}
+
+std::vector<float, AlignedAllocator<float>> paddedEmbedding(const std::vector<float>& embedding, int stride) {
+  std::vector<float, AlignedAllocator<float>> q(stride, 0.0f);
+  std::copy(embedding.begin(), embedding.begin() + std::min((int)embedding.size(), stride), q.begin());
+  return q;
+}
+
+EmbeddingIndex::EmbeddingIndex(const std::vector<std::string>& train_labels,
+  const std::vector<std::vector<float>>& train_features) {
+  build(train_labels, train_features);
+}
+
+/*
+  Copy the embeddings into one aligned matrix; the zero padding at the end of each
+  row adds nothing to the distance, so the kernels never need a tail on the DB side.
+*/
+void EmbeddingIndex::build(const std::vector<std::string>& train_labels,
+  const std::vector<std::vector<float>>& train_features) {
+  labels.clear();
+  data.clear();
+  norms.clear();
+  order.clear();
+  numDims = 0;
+  stride = 0;
+  if (train_labels.empty() || train_features.empty()) return;
+
+  numDims = (int)train_features[0].size();
+  stride = embeddingStride(numDims);
+
+  size_t rows = 0;
+  for (size_t i = 0; i < train_features.size() && i < train_labels.size(); i++) {
+    if ((int)train_features[i].size() == numDims) rows++;
+  }
+  data.assign(rows * stride, 0.0f);
+  labels.reserve(rows);
+
+  for (size_t i = 0; i < train_features.size() && i < train_labels.size(); i++) {
+    if ((int)train_features[i].size() != numDims) continue; // never matches a query
+    std::copy(train_features[i].begin(), train_features[i].end(), data.begin() + labels.size() * stride);
+    labels.push_back(classLabels().intern(train_labels[i]));
+  }
+
+  if (useVarianceOrder) permuteColumns(columnsByVariance());
+
+  norms.resize(labels.size());
+  for (size_t i = 0; i < labels.size(); i++) {
+    const float* r = row((int)i);
+    float sum = 0.0f;
+    for (int k = 0; k < numDims; k++) sum += r[k] * r[k];
+    norms[i] = sum;
+  }
+  if (usePruning) prototypes.build(labels, data.data(), numDims, stride);
+}
+
+void EmbeddingIndex::clear() {
+  std::vector<int>().swap(labels);
+  std::vector<float, AlignedAllocator<float>>().swap(data);
+  std::vector<float>().swap(norms);
+  order.clear();
+  numDims = 0;
+  stride = 0;
+  prototypes.clear();
+}
+
+void EmbeddingIndex::setEarlyAbandon(bool on, bool varianceOrder) {
+  useEarlyAbandon = on;
+  useVarianceOrder = on && varianceOrder;
+
+  std::vector<int> newOrder = useVarianceOrder ? columnsByVariance() : std::vector<int>();
+  if (newOrder == order) return;
+  permuteColumns(newOrder);
+  if (usePruning) prototypes.build(labels, data.data(), numDims, stride);
+}
+
+/*
+  Input dimensions by decreasing variance over the rows: the dimensions that differ most
+  come first, so a row that can't win crosses the bound in the first blocks.
+*/
+std::vector<int> EmbeddingIndex::columnsByVariance() const {
+  if (labels.empty()) return std::vector<int>();
+
+  std::vector<double> mean(numDims, 0.0), var(numDims, 0.0);
+  for (int i = 0; i < size(); i++) {
+    const float* r = row(i);
+    for (int k = 0; k < numDims; k++) mean[k] += r[k];
+  }
+  for (int k = 0; k < numDims; k++) mean[k] /= size();
+  for (int i = 0; i < size(); i++) {
+    const float* r = row(i);
+    for (int k = 0; k < numDims; k++) {
+      double d = r[k] - mean[k];
+      var[k] += d * d;
+    }
+  }
+
+  // stored columns by variance, then mapped back to input dimensions
+  std::vector<int> cols(numDims);
+  std::iota(cols.begin(), cols.end(), 0);
+  std::stable_sort(cols.begin(), cols.end(), [&](int a, int b) { return var[a] > var[b]; });
+  for (int& c : cols) c = order.empty() ? c : order[c];
+  return cols;
+}
+
+/*
+  Rearrange the stored columns from `order` to newOrder (both in input dimensions)
+*/
+void EmbeddingIndex::permuteColumns(const std::vector<int>& newOrder) {
+  std::vector<float> input(numDims);
+  for (int i = 0; i < size(); i++) {
+    float* r = data.data() + (size_t)i * stride;
+    for (int k = 0; k < numDims; k++) input[order.empty() ? k : order[k]] = r[k];
+    for (int k = 0; k < numDims; k++) r[k] = input[newOrder.empty() ? k : newOrder[k]];
+  }
+  order = newOrder;
+}
+
+/*
+  Query into a zeroed row of stride floats, in the column order of the rows
+*/
+void EmbeddingIndex::storeQuery(const std::vector<float>& query, float* dst) const {
+  if (order.empty()) {
+    std::copy(query.begin(), query.end(), dst);
+    return;
+  }
+  for (int k = 0; k < numDims; k++) dst[k] = query[order[k]];
+}
+
+void EmbeddingIndex::setPruning(bool on) {
+  usePruning = on;
+  if (on) {
+    prototypes.build(labels, data.data(), numDims, stride);
+  } else {
+    prototypes.clear();
+  }
+}
+
+int EmbeddingIndex::nearest(const std::vector<float>& query, float& ssd) const {
+  ssd = std::numeric_limits<float>::infinity();
+  if (labels.empty() || (int)query.size() != numDims) return -1;
+
+  // query padded (and ordered) like the rows
+  std::vector<float, AlignedAllocator<float>> q = paddedEmbedding(query, stride);
+  if (!order.empty()) storeQuery(query, q.data());
+
+  L2Kernel l2 = l2Dispatch().fn;
+  L2BoundedKernel l2b = l2Dispatch().bounded;
+  int best_idx = -1;
+  if (usePruning) {
+    double best_sq;
+    best_idx = prototypes.nearest(std::vector<double>(q.begin(), q.begin() + numDims),
+      [&](int i, double bound) {
+        // bound is a float SSD (or infinity), so the cast is exact
+        return (double)(useEarlyAbandon ? l2b(q.data(), row(i), stride, (float)bound) : l2(q.data(), row(i), stride));
+      }, best_sq);
+    ssd = (float)best_sq; // exact: it came from the float kernel
+    return best_idx;
+  }
+
+  const float* r = data.data();
+  for (int i = 0; i < (int)labels.size(); i++, r += stride) {
+    float dist = useEarlyAbandon ? l2b(q.data(), r, stride, ssd) : l2(q.data(), r, stride);
+    if (dist < ssd) {
+      ssd = dist;
+      best_idx = i;
+    }
+  }
+  return best_idx;
+}
+
+int EmbeddingIndex::classify(const std::vector<float>& query, float& accuracy) const {
+  float min_dist;
+  int best_idx = nearest(query, min_dist);
+  if (best_idx == -1) {
+    accuracy = 0.0f;
+    return LABEL_UNKNOWN;
+  }
+
+  accuracy = cnnConfidence(min_dist, numDims);
+  return labels[best_idx];
+}
+
+/*
+  Per DB block: dots = -2 Q X^T (one gemm), then d = ||q||^2 + ||x||^2 + dots. The
+  expansion cancels badly for near matches: it and the kernel can each be off by about
+  dims * eps * (||q||^2 + ||x||^2), so every row within that margin of the k-th best
+  upper bound is a candidate, and all candidates get their SSD from the kernel before
+  the final sort. Near-duplicate rows widen the candidate list, never drop the winner.
+*/
+std::vector<std::vector<std::pair<float, int>>> EmbeddingIndex::searchBatch(
+  const std::vector<std::vector<float>>& queries, int k) const {
+  std::vector<std::vector<std::pair<float, int>>> result(queries.size());
+  if (labels.empty() || k < 1) return result;
+
+  // stack the queries of the right length, padded (and ordered) like the rows
+  std::vector<int> slot;
+  for (size_t i = 0; i < queries.size(); i++) {
+    if ((int)queries[i].size() == numDims) slot.push_back((int)i);
+  }
+  if (slot.empty()) return result;
+
+  const int nq = (int)slot.size();
+  cv::Mat q(nq, stride, CV_32F, cv::Scalar(0));
+  std::vector<float> qNorm(nq);
+  for (int j = 0; j < nq; j++) {
+    const std::vector<float>& src = queries[slot[j]];
+    storeQuery(src, q.ptr<float>(j));
+    float sum = 0.0f;
+    for (float v : src) sum += v * v;
+    qNorm[j] = sum;
+  }
+
+  // round-off of the expansion plus that of the kernel, relative to ||q||^2 + ||x||^2
+  const float errScale = 3.0f * (numDims + 4) * std::numeric_limits<float>::epsilon();
+
+  const int n = size();
+  std::vector<std::priority_queue<float>> upper(nq); // k smallest d + margin
+  std::vector<std::vector<std::pair<float, int>>> cand(nq); // (d - margin, id) that may beat them
+  cv::Mat db(n, stride, CV_32F, const_cast<float*>(data.data()));
+  cv::Mat dots;
+  for (int r0 = 0; r0 < n; r0 += BATCH_ROWS) {
+    const int r1 = std::min(n, r0 + BATCH_ROWS);
+    cv::gemm(q, db.rowRange(r0, r1), -2.0, cv::noArray(), 0.0, dots, cv::GEMM_2_T);
+    for (int j = 0; j < nq; j++) {
+      const float* dj = dots.ptr<float>(j);
+      std::priority_queue<float>& heap = upper[j];
+      for (int i = r0; i < r1; i++) {
+        float d = qNorm[j] + norms[i] + dj[i - r0];
+        float margin = errScale * (qNorm[j] + norms[i]);
+        if ((int)heap.size() < k) {
+          heap.push(d + margin);
+        }
+        else if (d + margin < heap.top()) {
+          heap.pop();
+          heap.push(d + margin);
+        }
+        if ((int)heap.size() < k || d - margin <= heap.top()) cand[j].push_back({ d - margin, i });
+      }
+    }
+  }
+
+  L2Kernel l2 = l2Dispatch().fn;
+  L2BoundedKernel l2b = l2Dispatch().bounded;
+  const float inf = std::numeric_limits<float>::infinity();
+  for (int j = 0; j < nq; j++) {
+    std::vector<std::pair<float, int>>& r = result[slot[j]];
+    const float* qj = q.ptr<float>(j);
+    // the k-th smallest upper bound only shrank while scanning, drop what it now rules out
+    const float limit = (int)upper[j].size() < k ? inf : upper[j].top();
+    std::vector<std::pair<float, int>>& c = cand[j];
+    c.erase(std::remove_if(c.begin(), c.end(), [&](const std::pair<float, int>& e) { return e.first > limit; }), c.end());
+
+    if (!useEarlyAbandon) {
+      for (const auto& [lower, i] : c) r.push_back({ l2(qj, row(i), stride), i });
+    } else {
+      // most promising first, each one bounded by the k-th best exact SSD so far
+      std::sort(c.begin(), c.end());
+      std::priority_queue<float> kth;
+      for (const auto& [lower, i] : c) {
+        const float bound = (int)kth.size() < k ? inf : kth.top();
+        float d = l2b(qj, row(i), stride, bound);
+        if (d > bound) continue; // worse than k others
+        r.push_back({ d, i });
+        kth.push(d);
+        if ((int)kth.size() > k) kth.pop();
+      }
+    }
+    std::sort(r.begin(), r.end()); // ties: lowest id, like nearest()
+    if ((int)r.size() > k) r.resize(k);
+  }
+  return result;
+}
+
+std::vector<int> EmbeddingIndex::classifyBatch(const std::vector<std::vector<float>>& queries,
+  std::vector<float>& accuracy) const {
+  std::vector<std::vector<std::pair<float, int>>> nn = searchBatch(queries, 1);
+  std::vector<int> ids(queries.size(), LABEL_UNKNOWN);
+  accuracy.assign(queries.size(), 0.0f);
+  for (size_t i = 0; i < nn.size(); i++) {
+    if (nn[i].empty()) continue;
+    accuracy[i] = cnnConfidence(nn[i][0].first, numDims);
+    ids[i] = labels[nn[i][0].second];
+  }
+  return ids;
+}
@@ -0,0 +1,191 @@
+/*
+  Parker Cai
+  February 21, 2026
+  CS5330 - Project 3: Real-time 2-D Object Recognition
+
+  Asynchronous CNN embedding stage: worker threads with their own networks
+*/
+
+#include "embedding_worker.h"
+#include "utilities.h"
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <algorithm>
+#include <print>
+
+EmbeddingWorker::~EmbeddingWorker() {
+  stop();
+}
+
+/*
+  Loads all networks first so a bad model path throws before any thread runs.
+*/
+void EmbeddingWorker::start(const std::string& modelPath, int threads, int maxQueue) {
+  stop();
+  threads = std::max(1, threads);
+
+  std::vector<cv::dnn::Net> nets;
+  for (int i = 0; i < threads; i++) {
+    nets.push_back(cv::dnn::readNetFromONNX(modelPath));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    this->maxQueue = (size_t)std::max(1, maxQueue);
+    maxBatch = std::max<size_t>(1, this->maxQueue / threads); // leave work for the other threads
+    stopping = false;
+  }
+  for (auto& net : nets) {
+    workers.emplace_back(&EmbeddingWorker::run, this, net);
+  }
+}
+
+void EmbeddingWorker::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  cond.notify_all();
+  for (auto& t : workers) {
+    t.join();
+  }
+  workers.clear();
+
+  std::lock_guard<std::mutex> lock(mtx);
+  queue.clear();
+  results.clear();
+}
+
+void EmbeddingWorker::setDemand(unsigned consumer, bool on) {
+  unsigned before = demand;
+  demand = on ? (demand | consumer) : (demand & ~consumer);
+  if (before != 0 && demand == 0) {
+    // nobody is listening: don't let stale crops or results outlive the demand
+    std::lock_guard<std::mutex> lock(mtx);
+    queue.clear();
+    results.clear();
+    generation++; // batches already running are discarded as well
+  }
+}
+
+/*
+  Embeddings for this frame: crops of the regions the track cache could not serve go to
+  the workers, finished embeddings are attached. Done once per frame, on first demand.
+*/
+void EmbeddingWorker::embed(const cv::Mat& frame, std::vector<RegionInfo>& regions) {
+  if (!demanded() || embeddedFrame == frameId) return;
+  embeddedFrame = frameId;
+
+  for (auto& region : regions) {
+    if (region.cached && !region.embeddingVector.empty()) continue; // reused from the track cache
+
+    // rotate, crop and scale the region to the 224x224 network input in one warp
+    cv::Mat embImg;
+    prepEmbeddingInput(frame, embImg,
+      (int)region.centroid.x, (int)region.centroid.y,
+      region.theta,
+      region.uMin, region.uMax,
+      region.vMin, region.vMax);
+
+    submit(region.trackId, embImg);
+  }
+  collect(regions);
+}
+
+/*
+  A newer crop replaces a pending one of the same track; a full queue drops its oldest job.
+*/
+void EmbeddingWorker::submit(int trackId, const cv::Mat& crop) {
+  if (workers.empty() || trackId < 0 || crop.empty()) return;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = std::find_if(queue.begin(), queue.end(),
+      [&](const Job& j) { return j.trackId == trackId; });
+    if (it != queue.end()) {
+      queue.erase(it);
+    }
+    else if (queue.size() >= maxQueue) {
+      queue.pop_front();
+      numDropped++;
+    }
+    queue.push_back({ trackId, crop, nextSeq++ });
+  }
+  cond.notify_one();
+}
+
+void EmbeddingWorker::collect(std::vector<RegionInfo>& regions) {
+  std::lock_guard<std::mutex> lock(mtx);
+  for (auto& region : regions) {
+    auto it = results.find(region.trackId);
+    if (it == results.end()) continue;
+    Result& r = it->second;
+    if (r.fresh || region.embeddingVector.empty()) {
+      region.embeddingVector = r.embedding;
+      region.cnnClassId = LABEL_NONE; // classify the new embedding
+      region.cnnConfidence = 0.0f;
+    }
+  }
+
+  // mark delivered, forget tracks that are gone
+  for (auto it = results.begin(); it != results.end();) {
+    bool alive = std::any_of(regions.begin(), regions.end(),
+      [&](const RegionInfo& region) { return region.trackId == it->first; });
+    if (!alive) {
+      it = results.erase(it);
+    }
+    else {
+      it->second.fresh = false;
+      ++it;
+    }
+  }
+}
+
+uint64_t EmbeddingWorker::dropped() const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return numDropped;
+}
+
+/*
+  Worker thread: take up to maxBatch queued crops, one batched forward pass, publish.
+  A batch whose forward pass throws is dropped.
+  Threads can finish out of order, so a result only replaces an older one (by seq).
+  A batch taken before setDemand() dropped everything is not published.
+*/
+void EmbeddingWorker::run(cv::dnn::Net net) {
+  std::vector<Job> batch;
+  std::vector<cv::Mat> crops;
+  uint64_t batchGeneration = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cond.wait(lock, [&] { return stopping || !queue.empty(); });
+      if (stopping) return;
+      size_t n = std::min(queue.size(), maxBatch);
+      batch.assign(std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.begin() + n));
+      queue.erase(queue.begin(), queue.begin() + n);
+      batchGeneration = generation;
+    }
+
+    crops.clear();
+    for (const Job& j : batch) crops.push_back(j.crop);
+    cv::Mat embeddings;
+    try {
+      getEmbeddings(crops, embeddings, net, 0);
+    } catch (const cv::Exception& e) {
+      // an exception must not leave the thread: drop this batch, its tracks resubmit
+      std::println("ERROR: CNN embedding batch failed: {}", e.what());
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (batchGeneration != generation) continue; // demand ended while this batch ran
+    for (int k = 0; k < embeddings.rows && k < (int)batch.size(); k++) {
+      Result& r = results[batch[k].trackId];
+      if (!r.embedding.empty() && r.seq > batch[k].seq) continue;
+      const float* row = embeddings.ptr<float>(k);
+      r.embedding.assign(row, row + embeddings.cols);
+      r.seq = batch[k].seq;
+      r.fresh = true;
+    }
+  }
+}
@@ -11,17 +11,20 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <map>
 #include <fstream>
 #include <iomanip>
 
 // adds a new class label if we haven't seen it yet
 // needed because we don't know all classes upfront
-void addClassToMatrix(ConfusionMatrix& cm, const std::string& name) {
-    if(cm.class_index.find(name) == cm.class_index.end()) {
+void addClassToMatrix(ConfusionMatrix& cm, int id) {
+    if(id < 0) return;
+    if(id >= (int)cm.class_index.size()) {
+        cm.class_index.resize(id + 1, -1);
+    }
+    if(cm.class_index[id] == -1) {
         int idx = cm.classes.size();
-        cm.classes.push_back(name);
-        cm.class_index[name] = idx;
+        cm.classes.push_back(id);
+        cm.class_index[id] = idx;
         
         // have to resize every existing row too, not just add a new one
         cm.matrix.resize(cm.classes.size());
@@ -31,7 +34,8 @@ void addClassToMatrix(ConfusionMatrix& cm, const std::string& name) {
     }
 }
 
-void addResultToMatrix(ConfusionMatrix& cm, const std::string& true_label, const std::string& pred_label) {
+void addResultToMatrix(ConfusionMatrix& cm, int true_label, int pred_label) {
+    if(true_label < 0 || pred_label < 0) return; // LABEL_NONE, nothing to count
     // make sure both labels exist before we try to index into anything
     addClassToMatrix(cm, true_label);
     addClassToMatrix(cm, pred_label);
@@ -47,7 +51,7 @@ void printConfusionMatrix(ConfusionMatrix& cm) {
     // column headers
     std::cout << std::setw(18) << "";
     for(size_t i = 0; i < cm.classes.size(); i++) {
-        std::cout << std::setw(18) << cm.classes[i];
+        std::cout << std::setw(18) << classLabels().name(cm.classes[i]);
     }
     std::cout << std::endl;
     
@@ -57,7 +61,7 @@ void printConfusionMatrix(ConfusionMatrix& cm) {
     std::cout << std::endl;
     
     for(size_t i = 0; i < cm.matrix.size(); i++) {
-        std::cout << std::setw(18) << cm.classes[i];
+        std::cout << std::setw(18) << classLabels().name(cm.classes[i]);
         for(size_t j = 0; j < cm.matrix[i].size(); j++) {
             std::cout << std::setw(18) << cm.matrix[i][j];
         }
@@ -83,7 +87,7 @@ void printConfusionMatrix(ConfusionMatrix& cm) {
             row_total += cm.matrix[i][j];
         
         double class_acc = (row_total > 0) ? (100.0 * cm.matrix[i][i]) / row_total : 0.0;
-        std::cout << "  " << cm.classes[i] << ": " 
+        std::cout << "  " << classLabels().name(cm.classes[i]) << ": " 
                   << std::fixed << std::setprecision(1) << class_acc << "%" << std::endl;
     }
     std::cout << "========================\n" << std::endl;
@@ -95,11 +99,11 @@ void saveConfusionMatrix(ConfusionMatrix& cm, const std::string& filename) {
     
     file << "True\\Predicted";
     for(size_t i = 0; i < cm.classes.size(); i++)
-        file << "," << cm.classes[i];
+        file << "," << classLabels().name(cm.classes[i]);
     file << "\n";
     
     for(size_t i = 0; i < cm.matrix.size(); i++) {
-        file << cm.classes[i];
+        file << classLabels().name(cm.classes[i]);
         for(size_t j = 0; j < cm.matrix[i].size(); j++)
             file << "," << cm.matrix[i][j];
         file << "\n";
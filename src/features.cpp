@@ -10,42 +10,144 @@
 #include "or2d.h"
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <array>
+#include <climits>
 #include <cmath>
 
 
 /*
-  Compute features for a single region using region-based analysis.
+  Moments and per-row extents for several regions in one sweep over the label map
 
-  Steps:
-    1. Extracts a binary mask for the region (labelMap == region.label)
-    2. Computes moments via cv::moments() on the binary mask
-    3. Derives the principal axis angle (axis of least central moment)
-    4. Projects all region pixels onto the principal and perpendicular axes
-        to compute the oriented bounding box (OBB) region-based
-    5. Computes percent filled = region area / OBB area
-    6. Computes OBB aspect ratio = min(w,h) / max(w,h)  (always in [0,1])
-    7. Computes Hu moment invariants via cv::HuMoments()
-    8. Assembles a feature vector: {percentFilled, bboxRatio, log|hu0|, log|hu1|}
+  Only the union of the region bboxes is visited. Each pixel is sent to its region's
+  accumulator through a label -> index table. Per row, a region collects its pixel count,
+  the sums of x, x^2, x^3 and its leftmost/rightmost column; at the end of the row these
+  are folded into the raw moments with the powers of y. The row extents are all that the
+  OBB projection needs: along a row the projection is linear in x, so the extremes are at
+  the leftmost and rightmost pixels.
+
+  Output per region: cv::Moments (same values as cv::moments on its mask) and row extents
+  (row, first column, one past the last column)
 */
-void computeRegionFeatures(const cv::Mat& labelMap, RegionInfo& region) {
-  // 1. Extract binary mask for this region from the label map
-  cv::Mat mask = cv::Mat::zeros(labelMap.size(), CV_8U);
-  for (int r = 0; r < labelMap.rows; r++) {
-    for (int c = 0; c < labelMap.cols; c++) {
-      if (labelMap.at<int>(r, c) == region.label) {
-        mask.at<uchar>(r, c) = 255;
-      }
+static void sweepRegions(const cv::Mat& labelMap, const std::vector<RegionInfo*>& regs,
+  std::vector<cv::Moments>& moments, std::vector<std::vector<cv::Vec3i>>& extents) {
+  const int n = (int)regs.size();
+  moments.assign(n, cv::Moments());
+  extents.assign(n, {});
+  if (n == 0) {
+    return;
+  }
+
+  // label -> region index, and the area to sweep
+  const cv::Rect frame(0, 0, labelMap.cols, labelMap.rows);
+  int maxLabel = 0;
+  cv::Rect area;
+  for (const RegionInfo* r : regs) {
+    maxLabel = std::max(maxLabel, r->label);
+    cv::Rect box = (r->bbox.area() > 0) ? (r->bbox & frame) : frame; // no bbox: whole frame
+    area = (area.area() > 0) ? (area | box) : box;
+  }
+  std::vector<int> lut(maxLabel + 1, -1);
+  for (int i = 0; i < n; i++) {
+    if (regs[i]->label > 0) lut[regs[i]->label] = i;
+  }
+
+  struct RowAccum {
+    int64_t count, sx, sx2, sx3;
+    int minX, maxX;
+  };
+  std::vector<std::array<double, 10>> m(n, std::array<double, 10>{}); // m00 m10 m01 m20 m11 m02 m30 m21 m12 m03
+  std::vector<RowAccum> row(n);
+
+  for (int y = area.y; y < area.y + area.height; y++) {
+    for (auto& acc : row) {
+      acc = { 0, 0, 0, 0, INT_MAX, -1 };
     }
+    const int* labels = labelMap.ptr<int>(y);
+    for (int x = area.x; x < area.x + area.width; x++) {
+      int label = labels[x];
+      if (label <= 0 || label > maxLabel || lut[label] < 0) continue;
+      RowAccum& acc = row[lut[label]];
+      const int64_t xx = x;
+      acc.count++;
+      acc.sx += xx;
+      acc.sx2 += xx * xx;
+      acc.sx3 += xx * xx * xx;
+      acc.minX = std::min(acc.minX, x);
+      acc.maxX = x; // x only grows along the row
+    }
+
+    const double y1 = y, y2 = y1 * y1, y3 = y2 * y1;
+    for (int i = 0; i < n; i++) {
+      const RowAccum& acc = row[i];
+      if (acc.count == 0) continue;
+      const double s0 = (double)acc.count, s1 = (double)acc.sx, s2 = (double)acc.sx2, s3 = (double)acc.sx3;
+      m[i][0] += s0;
+      m[i][1] += s1;
+      m[i][2] += y1 * s0;
+      m[i][3] += s2;
+      m[i][4] += y1 * s1;
+      m[i][5] += y2 * s0;
+      m[i][6] += s3;
+      m[i][7] += y1 * s2;
+      m[i][8] += y2 * s1;
+      m[i][9] += y3 * s0;
+      extents[i].push_back(cv::Vec3i(y, acc.minX, acc.maxX + 1));
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    moments[i] = cv::Moments(m[i][0], m[i][1], m[i][2], m[i][3], m[i][4],
+      m[i][5], m[i][6], m[i][7], m[i][8], m[i][9]);
+  }
+}
+
+/*
+  Convex hull of the end pixels of the extents (Andrew's monotone chain)
+
+  The extents come sorted by row and each one gives its first then last pixel, so the
+  points are already in (y, x) order and the hull is built in one pass each way without
+  sorting. Only hull vertices can be extremes of a linear projection.
+*/
+static void extentHull(const std::vector<cv::Vec3i>& extents, std::vector<cv::Point>& hull) {
+  std::vector<cv::Point> pts;
+  pts.reserve(extents.size() * 2);
+  for (const cv::Vec3i& e : extents) {
+    pts.push_back(cv::Point(e[1], e[0]));
+    if (e[2] - 1 != e[1]) pts.push_back(cv::Point(e[2] - 1, e[0]));
+  }
+
+  // cross product of (a - o) x (b - o), > 0 for a counter-clockwise turn
+  auto cross = [](const cv::Point& o, const cv::Point& a, const cv::Point& b) {
+    return (int64_t)(a.x - o.x) * (b.y - o.y) - (int64_t)(a.y - o.y) * (b.x - o.x);
+  };
+
+  const int n = (int)pts.size();
+  if (n < 3) {
+    hull = pts;
+    return;
   }
+  hull.resize(2 * n);
+  int k = 0;
+  for (int i = 0; i < n; i++) {
+    while (k >= 2 && cross(hull[k - 2], hull[k - 1], pts[i]) <= 0) k--;
+    hull[k++] = pts[i];
+  }
+  for (int i = n - 2, lower = k + 1; i >= 0; i--) {
+    while (k >= lower && cross(hull[k - 2], hull[k - 1], pts[i]) <= 0) k--;
+    hull[k++] = pts[i];
+  }
+  hull.resize(k - 1); // the last point repeats the first
+}
 
-  // 2. Compute moments on the binary mask
-  //    cv::moments(mask, true) computes:
-  //      Spatial moments:  m00, m10, m01, m20, m11, m02, m30, m21, m12, m03
-  //      Central moments:  mu20, mu11, mu02, mu30, mu21, mu12, mu03
-  //      Normalized central moments: nu20, nu11, nu02, nu30, nu21, nu12, nu03
-  //    binaryImage=true treats any nonzero pixel as 1 (no weighting by intensity).
-  cv::Moments m = cv::moments(mask, true);
+/*
+  Everything that follows from the moments and the row extents (steps 3-8 below)
 
+  extents: (row, first column, one past the last column), either the region's runs
+  or one entry per row from sweepRegions(); only the two ends of each are projected,
+  or with OBB_METHOD_HULL only the convex hull vertices of those ends.
+*/
+static void finishRegionFeatures(RegionInfo& region, const cv::Moments& m,
+  const std::vector<cv::Vec3i>& extents, int obbMethod) {
   // 3. Axis of least central moment (principal orientation)
   //    theta = 0.5 * atan2(2 * mu11, mu20 - mu02)
   //    This angle minimizes the moment of inertia about the axis through the centroid.
@@ -54,6 +156,8 @@ void computeRegionFeatures(const cv::Mat& labelMap, RegionInfo& region) {
   // 4. Oriented Bounding Box (OBB) via region pixel projection
   //    Project each region pixel onto the principal axis (u) and perpendicular axis (v)
   //    relative to the centroid. Track min/max of u and v to get the OBB extents.
+  //    The projection is linear along a row, so the first and last pixel of each
+  //    extent give the same min/max as all of its pixels.
   float cosT = std::cos(region.theta);
   float sinT = std::sin(region.theta);
   float uMin = std::numeric_limits<float>::max();
@@ -61,19 +165,30 @@ void computeRegionFeatures(const cv::Mat& labelMap, RegionInfo& region) {
   float vMin = std::numeric_limits<float>::max();
   float vMax = std::numeric_limits<float>::lowest();
 
-  // Iterate through the mask pixels to find the OBB extents in the rotated coordinate frame
-  for (int r = 0; r < mask.rows; r++) {
-    for (int c = 0; c < mask.cols; c++) {
-      if (mask.at<uchar>(r, c) == 0) continue;
-      float dx = c - region.centroid.x;
-      float dy = r - region.centroid.y;
-      // Project onto principal axis (u) and perpendicular (v)
-      float u = dx * cosT + dy * sinT;
-      float v = -dx * sinT + dy * cosT;
-      uMin = std::min(uMin, u);
-      uMax = std::max(uMax, u);
-      vMin = std::min(vMin, v);
-      vMax = std::max(vMax, v);
+  auto project = [&](int c, int r) {
+    float dx = c - region.centroid.x;
+    float dy = r - region.centroid.y;
+    // Project onto principal axis (u) and perpendicular (v)
+    float u = dx * cosT + dy * sinT;
+    float v = -dx * sinT + dy * cosT;
+    uMin = std::min(uMin, u);
+    uMax = std::max(uMax, u);
+    vMin = std::min(vMin, v);
+    vMax = std::max(vMax, v);
+  };
+
+  if (obbMethod == OBB_METHOD_HULL) {
+    // O(perimeter) boundary points -> a few dozen hull vertices
+    std::vector<cv::Point> hull;
+    extentHull(extents, hull);
+    for (const cv::Point& p : hull) {
+      project(p.x, p.y);
+    }
+  }
+  else {
+    for (const cv::Vec3i& e : extents) {
+      project(e[1], e[0]);
+      project(e[2] - 1, e[0]);
     }
   }
 
@@ -136,6 +251,70 @@ void computeRegionFeatures(const cv::Mat& labelMap, RegionInfo& region) {
 }
 
 
+/*
+  Compute features for a single region using region-based analysis.
+
+  Steps:
+    1. Finds the region pixels (labelMap == region.label) inside its bounding box
+    2. Accumulates the moments in the same sweep (see sweepRegions); same values as
+       cv::moments() on the region mask:
+         Spatial moments:  m00, m10, m01, m20, m11, m02, m30, m21, m12, m03
+         Central moments:  mu20, mu11, mu02, mu30, mu21, mu12, mu03
+         Normalized central moments: nu20, nu11, nu02, nu30, nu21, nu12, nu03
+    3. Derives the principal axis angle (axis of least central moment)
+    4. Projects all region pixels onto the principal and perpendicular axes
+        to compute the oriented bounding box (OBB) region-based. Only the first and
+        last pixel of each row can be extremes (OBB_METHOD_PIXELS), and of those only
+        the convex hull vertices (OBB_METHOD_HULL, default); both give the same OBB
+    5. Computes percent filled = region area / OBB area
+    6. Computes OBB aspect ratio = min(w,h) / max(w,h)  (always in [0,1])
+    7. Computes Hu moment invariants via cv::HuMoments()
+    8. Assembles a feature vector: {percentFilled, bboxRatio, log|hu0|, log|hu1|}
+
+  Regions from the run-length labeling already have their moments and runs, so steps 1-2
+  are skipped and the label map is not touched.
+*/
+void computeRegionFeatures(const cv::Mat& labelMap, RegionInfo& region, int obbMethod) {
+  if (!region.runs.empty()) {
+    finishRegionFeatures(region, region.moments, region.runs, obbMethod);
+    return;
+  }
+
+  std::vector<cv::Moments> moments;
+  std::vector<std::vector<cv::Vec3i>> extents;
+  sweepRegions(labelMap, { &region }, moments, extents);
+  finishRegionFeatures(region, moments[0], extents[0], obbMethod);
+}
+
+/*
+  Compute features for all regions of a frame.
+
+  Regions without runs share a single sweep over the union of their bounding boxes,
+  so the cost no longer grows with regions x frame size. Cached regions are skipped.
+*/
+void computeAllRegionFeatures(const cv::Mat& labelMap, std::vector<RegionInfo>& regions, int obbMethod) {
+  std::vector<RegionInfo*> toSweep;
+  for (RegionInfo& region : regions) {
+    if (region.cached) {
+      continue; // features reused from the track cache
+    }
+    if (region.runs.empty()) {
+      toSweep.push_back(&region);
+    }
+    else {
+      finishRegionFeatures(region, region.moments, region.runs, obbMethod);
+    }
+  }
+
+  std::vector<cv::Moments> moments;
+  std::vector<std::vector<cv::Vec3i>> extents;
+  sweepRegions(labelMap, toSweep, moments, extents);
+  for (size_t i = 0; i < toSweep.size(); i++) {
+    finishRegionFeatures(*toSweep[i], moments[i], extents[i], obbMethod);
+  }
+}
+
+
 /*
   Draw feature overlays on an image for all regions.
 
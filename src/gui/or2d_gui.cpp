@@ -40,6 +40,9 @@
 
 #include "or2d.h"
 #include "utilities.h"
+#include "embedding_worker.h"
+#include "hnsw_index.h"
+#include "pq_index.h"
 
 // ============================================================================
 // Helpers
@@ -116,25 +119,38 @@ static const char* displayModeNames[] = {
   "Features (4)", "Classification (5)", "CNN Classification (6)"
 };
 
+static const char* cnnSearchNames[] = { "HNSW", "Compressed (PQ)", "Exact (batched)" }; // CnnSearch
+
 struct AppState {
   std::filesystem::path projectRoot;
   std::string db_filename;
   std::string cnn_db_filename;
+  std::string cnn_index_filename;
+  std::string cnn_pq_filename;
   std::string cnn_model_path;
 
   cv::VideoCapture cap;
   int camNum = 0;
   bool auto_mode = true;
   int manual_thresh = 120;
+  int auto_thresh = -1; // last auto threshold, warm-starts the next frame
+  bool local_thresh = false; // per-tile (adaptive) auto threshold for uneven lighting
+  int open_size = 3;  // opening element size (removes specks)
+  int close_size = 3; // closing element size (fills holes)
   int display_mode = 2;
   bool training_mode = false;
   bool eval_mode = false;
 
   std::vector<std::string> train_labels;
   std::vector<std::vector<double>> train_features;
+  FeatureIndex train_index; // rebuilt whenever the hand-built feature DB changes
   std::vector<std::string> cnn_train_labels;
   std::vector<std::vector<float>> cnn_train_features;
-  cv::dnn::Net cnn_net;
+  HnswIndex cnn_index; // approximate nearest neighbor over the CNN DB, kept on disk next to it
+  PqIndex cnn_pq; // compressed copy of the CNN DB, built while it is the selected search
+  EmbeddingIndex cnn_exact; // exact copy for batched search, built while it is the selected search
+  int cnn_search = CNN_SEARCH_HNSW;
+  EmbeddingWorker embedder; // runs the CNN off the frame loop
 
   ConfusionMatrix conf_matrix_features;
   ConfusionMatrix conf_matrix_cnn;
@@ -144,8 +160,13 @@ struct AppState {
 
   cv::Mat frame;
   std::vector<RegionInfo> regions;
+  cv::Mat thresh;  // this frame's binary image, saved with the cleaned / segmented ones
+  cv::Mat cleaned; // kept across frames so cleanupBinary() reuses the buffer
+  cv::Mat show;    // result image, kept across frames so colorizeRegions() reuses the buffer
   cv::Mat segmented;
   cv::Mat labelMap;
+  RegionTracker tracker; // region track IDs / colors across frames
+  TrackCache trackCache; // reuses features, embeddings and labels of objects that did not move
 
   GLuint texOriginal = 0;
   GLuint texResult = 0;
@@ -164,6 +185,31 @@ struct AppState {
 
 static AppState g_app;
 
+/*
+  CNN nearest neighbor through the selected search (HNSW, PQ re-ranked on the exact DB, or exact)
+*/
+static int classifyCnn(const std::vector<float>& query, float& conf) {
+  if (g_app.cnn_search == CNN_SEARCH_PQ) return classifyObjectCNN(query, g_app.cnn_pq, conf, &g_app.cnn_train_features);
+  if (g_app.cnn_search == CNN_SEARCH_EXACT) return classifyObjectCNN(query, g_app.cnn_exact, conf);
+  return classifyObjectCNN(query, g_app.cnn_index, conf);
+}
+
+/*
+  Rebuild the PQ / exact copy after the CNN DB was reloaded or edited (dropped while unused)
+*/
+static void refreshCnnSearch() {
+  if (g_app.cnn_search == CNN_SEARCH_PQ) {
+    g_app.cnn_pq.loadOrBuild(g_app.cnn_pq_filename, g_app.cnn_train_labels, g_app.cnn_train_features);
+  } else {
+    g_app.cnn_pq.clear();
+  }
+  if (g_app.cnn_search == CNN_SEARCH_EXACT) {
+    g_app.cnn_exact.build(g_app.cnn_train_labels, g_app.cnn_train_features);
+  } else {
+    g_app.cnn_exact.clear();
+  }
+}
+
 // ============================================================================
 // Keyboard shortcuts (when not in text input)
 // ============================================================================
@@ -186,6 +232,8 @@ static void handleKeyboardShortcuts(GLFWwindow* window) {
 
   if (ImGui::IsKeyPressed(ImGuiKey_A))
     g_app.auto_mode = !g_app.auto_mode;
+  if (ImGui::IsKeyPressed(ImGuiKey_G))
+    g_app.local_thresh = !g_app.local_thresh;
 
   if (ImGui::IsKeyPressed(ImGuiKey_Equal) || ImGui::IsKeyPressed(ImGuiKey_KeypadAdd))
     g_app.manual_thresh = std::min(g_app.manual_thresh + 5, 255);
@@ -206,30 +254,44 @@ static void handleKeyboardShortcuts(GLFWwindow* window) {
       if (!name.empty()) {
         saveTrainingExample(g_app.db_filename, name, g_app.regions[0].featureVector);
         loadTrainingData(g_app.db_filename, g_app.train_labels, g_app.train_features);
+        g_app.train_index.build(g_app.train_labels, g_app.train_features);
+        g_app.trackCache.clearLabels();
       }
     }
   }
   if (ImGui::IsKeyPressed(ImGuiKey_C)) {
-    if (g_app.training_mode && !g_app.regions.empty() && !g_app.cnn_net.empty() && !g_app.regions[0].embeddingVector.empty()) {
+    if (g_app.training_mode && !g_app.regions.empty() && g_app.embedder.ready() && !g_app.regions[0].embeddingVector.empty()) {
       std::string name(g_app.objectNameBuf);
       if (!name.empty()) {
         saveTrainingExample(g_app.cnn_db_filename, name, g_app.regions[0].embeddingVector);
         loadTrainingData(g_app.cnn_db_filename, g_app.cnn_train_labels, g_app.cnn_train_features);
+        if (!g_app.cnn_train_features.empty()) {
+          g_app.cnn_index.add(name, g_app.cnn_train_features.back()); // incremental insert, as stored in the CSV
+          g_app.cnn_index.save(g_app.cnn_index_filename);
+        }
+        if (!g_app.cnn_train_features.empty() && g_app.cnn_pq.add(name, g_app.cnn_train_features.back(), (int)g_app.cnn_train_features.size() - 1) >= 0) {
+          // as stored in the CSV, so the file still matches it; retrained while the DB is small
+          if (g_app.cnn_pq.stale()) g_app.cnn_pq.build(g_app.cnn_train_labels, g_app.cnn_train_features);
+          g_app.cnn_pq.save(g_app.cnn_pq_filename);
+        }
+        if (g_app.cnn_search == CNN_SEARCH_EXACT) g_app.cnn_exact.build(g_app.cnn_train_labels, g_app.cnn_train_features);
+        g_app.trackCache.clearLabels();
       }
     }
   }
   if (ImGui::IsKeyPressed(ImGuiKey_R)) {
     if (g_app.eval_mode && !g_app.regions.empty()) {
       double confF;
-      std::string predF = classifyObject(g_app.regions[0].featureVector, g_app.train_labels, g_app.train_features, confF);
+      int predF = classifyObject(g_app.regions[0].featureVector, g_app.train_index, confF);
       float confC;
-      std::string predC = "unknown";
+      int predC = LABEL_UNKNOWN;
       if (!g_app.regions[0].embeddingVector.empty() && !g_app.cnn_train_labels.empty())
-        predC = classifyObjectCNN(g_app.regions[0].embeddingVector, g_app.cnn_train_labels, g_app.cnn_train_features, confC);
+        predC = classifyCnn(g_app.regions[0].embeddingVector, confC);
       std::string trueLabel(g_app.trueLabelBuf);
       if (!trueLabel.empty()) {
-        addResultToMatrix(g_app.conf_matrix_features, trueLabel, predF);
-        addResultToMatrix(g_app.conf_matrix_cnn, trueLabel, predC);
+        int trueId = classLabels().intern(trueLabel);
+        addResultToMatrix(g_app.conf_matrix_features, trueId, predF);
+        addResultToMatrix(g_app.conf_matrix_cnn, trueId, predC);
       }
     }
   }
@@ -241,17 +303,16 @@ static void handleKeyboardShortcuts(GLFWwindow* window) {
     if (!g_app.frame.empty()) {
       std::string ts = std::to_string(getTime());
       std::string base = (g_app.projectRoot / "data").string() + "/" + ts;
-      cv::Mat thresh = g_app.auto_mode ? thresholdImage(g_app.frame) : thresholdImage(g_app.frame, g_app.manual_thresh);
-      cv::Mat cleaned = cleanupBinary(thresh);
+      // the images this frame was segmented from (local or global threshold alike)
       cv::imwrite(base + "_original.jpg", g_app.frame);
-      cv::imwrite(base + "_threshold.jpg", thresh);
-      cv::imwrite(base + "_cleaned.jpg", cleaned);
+      cv::imwrite(base + "_threshold.jpg", g_app.thresh);
+      cv::imwrite(base + "_cleaned.jpg", g_app.cleaned);
       cv::imwrite(base + "_segmented.jpg", g_app.segmented);
       cv::Mat featImg = colorizeRegions(g_app.labelMap, g_app.regions);
       drawFeatures(featImg, g_app.regions);
       cv::imwrite(base + "_features.jpg", featImg);
       cv::Mat classImg = colorizeRegions(g_app.labelMap, g_app.regions);
-      classifyAndLabel(classImg, g_app.regions, g_app.train_labels, g_app.train_features);
+      classifyAndLabel(classImg, g_app.regions, g_app.train_index);
       cv::imwrite(base + "_classified.jpg", classImg);
     }
   }
@@ -278,14 +339,14 @@ static void renderConfusionMatrixTable(ConfusionMatrix& cm, const char* id, bool
     ImGui::TableSetupScrollFreeze(1, 1);
     ImGui::TableSetupColumn("True \\ Pred", ImGuiTableColumnFlags_WidthFixed, 80.0f);
     for (int j = 0; j < n; j++)
-      ImGui::TableSetupColumn(cm.classes[j].c_str(), ImGuiTableColumnFlags_WidthFixed, 50.0f);
+      ImGui::TableSetupColumn(classLabels().name(cm.classes[j]).c_str(), ImGuiTableColumnFlags_WidthFixed, 50.0f);
     ImGui::TableSetupColumn("Acc %", ImGuiTableColumnFlags_WidthFixed, 50.0f);
     ImGui::TableHeadersRow();
 
     for (int i = 0; i < n; i++) {
       ImGui::TableNextRow();
       ImGui::TableSetColumnIndex(0);
-      ImGui::Text("%s", cm.classes[i].c_str());
+      ImGui::Text("%s", classLabels().name(cm.classes[i]).c_str());
 
       int rowTotal = 0;
       for (int j = 0; j < n; j++) rowTotal += cm.matrix[i][j];
@@ -331,17 +392,16 @@ static void renderLeftPanel(float totalHeight) {
     if (!g_app.frame.empty()) {
       std::string ts = std::to_string(getTime());
       std::string base = (g_app.projectRoot / "data").string() + "/" + ts;
+      // the images this frame was segmented from (local or global threshold alike)
       cv::imwrite(base + "_original.jpg", g_app.frame);
-      cv::Mat thresh = g_app.auto_mode ? thresholdImage(g_app.frame) : thresholdImage(g_app.frame, g_app.manual_thresh);
-      cv::Mat cleaned = cleanupBinary(thresh);
-      cv::imwrite(base + "_threshold.jpg", thresh);
-      cv::imwrite(base + "_cleaned.jpg", cleaned);
+      cv::imwrite(base + "_threshold.jpg", g_app.thresh);
+      cv::imwrite(base + "_cleaned.jpg", g_app.cleaned);
       cv::imwrite(base + "_segmented.jpg", g_app.segmented);
       cv::Mat featImg = colorizeRegions(g_app.labelMap, g_app.regions);
       drawFeatures(featImg, g_app.regions);
       cv::imwrite(base + "_features.jpg", featImg);
       cv::Mat classImg = colorizeRegions(g_app.labelMap, g_app.regions);
-      classifyAndLabel(classImg, g_app.regions, g_app.train_labels, g_app.train_features);
+      classifyAndLabel(classImg, g_app.regions, g_app.train_index);
       cv::imwrite(base + "_classified.jpg", classImg);
     }
   }
@@ -354,15 +414,16 @@ static void renderLeftPanel(float totalHeight) {
   if (ImGui::Button("Record Result [R]")) {
     if (g_app.eval_mode && !g_app.regions.empty()) {
       double confF;
-      std::string predF = classifyObject(g_app.regions[0].featureVector, g_app.train_labels, g_app.train_features, confF);
+      int predF = classifyObject(g_app.regions[0].featureVector, g_app.train_index, confF);
       float confC;
-      std::string predC = "unknown";
+      int predC = LABEL_UNKNOWN;
       if (!g_app.regions[0].embeddingVector.empty() && !g_app.cnn_train_labels.empty())
-        predC = classifyObjectCNN(g_app.regions[0].embeddingVector, g_app.cnn_train_labels, g_app.cnn_train_features, confC);
+        predC = classifyCnn(g_app.regions[0].embeddingVector, confC);
       std::string trueLabel(g_app.trueLabelBuf);
       if (!trueLabel.empty()) {
-        addResultToMatrix(g_app.conf_matrix_features, trueLabel, predF);
-        addResultToMatrix(g_app.conf_matrix_cnn, trueLabel, predC);
+        int trueId = classLabels().intern(trueLabel);
+        addResultToMatrix(g_app.conf_matrix_features, trueId, predF);
+        addResultToMatrix(g_app.conf_matrix_cnn, trueId, predC);
       }
     }
   }
@@ -412,6 +473,28 @@ static void renderMidPanel(float totalHeight) {
   if (!g_app.auto_mode) {
     ImGui::SliderInt("##thresh", &g_app.manual_thresh, 0, 255, "%d");
   }
+  else {
+    ImGui::SameLine();
+    ImGui::Checkbox("Local [G]", &g_app.local_thresh);
+    if (!g_app.local_thresh) {
+      ImGui::SameLine();
+      ImGui::Text("T = %d", g_app.auto_thresh);
+    }
+  }
+
+  ImGui::Separator();
+  ImGui::Text("Morphology");
+  ImGui::SliderInt("Open", &g_app.open_size, 1, 15, "%d px");
+  ImGui::SliderInt("Close", &g_app.close_size, 1, 31, "%d px");
+
+  ImGui::Separator();
+  ImGui::Text("CNN index");
+  int ef = g_app.cnn_index.getEf();
+  if (ImGui::SliderInt("ef", &ef, 1, 256, "%d")) g_app.cnn_index.setEf(ef); // recall vs. latency
+  if (ImGui::Combo("Search", &g_app.cnn_search, cnnSearchNames, 3)) {
+    refreshCnnSearch();
+    g_app.trackCache.clearLabels();
+  }
 
   ImGui::Separator();
   ImGui::Text("Training");
@@ -427,15 +510,28 @@ static void renderMidPanel(float totalHeight) {
       if (!name.empty()) {
         saveTrainingExample(g_app.db_filename, name, g_app.regions[0].featureVector);
         loadTrainingData(g_app.db_filename, g_app.train_labels, g_app.train_features);
+        g_app.train_index.build(g_app.train_labels, g_app.train_features);
+        g_app.trackCache.clearLabels();
       }
     }
   }
   if (ImGui::Button("Save CNN [C]")) {
-    if (g_app.training_mode && !g_app.regions.empty() && !g_app.cnn_net.empty() && !g_app.regions[0].embeddingVector.empty()) {
+    if (g_app.training_mode && !g_app.regions.empty() && g_app.embedder.ready() && !g_app.regions[0].embeddingVector.empty()) {
       std::string name(g_app.objectNameBuf);
       if (!name.empty()) {
         saveTrainingExample(g_app.cnn_db_filename, name, g_app.regions[0].embeddingVector);
         loadTrainingData(g_app.cnn_db_filename, g_app.cnn_train_labels, g_app.cnn_train_features);
+        if (!g_app.cnn_train_features.empty()) {
+          g_app.cnn_index.add(name, g_app.cnn_train_features.back()); // incremental insert, as stored in the CSV
+          g_app.cnn_index.save(g_app.cnn_index_filename);
+        }
+        if (!g_app.cnn_train_features.empty() && g_app.cnn_pq.add(name, g_app.cnn_train_features.back(), (int)g_app.cnn_train_features.size() - 1) >= 0) {
+          // as stored in the CSV, so the file still matches it; retrained while the DB is small
+          if (g_app.cnn_pq.stale()) g_app.cnn_pq.build(g_app.cnn_train_labels, g_app.cnn_train_features);
+          g_app.cnn_pq.save(g_app.cnn_pq_filename);
+        }
+        if (g_app.cnn_search == CNN_SEARCH_EXACT) g_app.cnn_exact.build(g_app.cnn_train_labels, g_app.cnn_train_features);
+        g_app.trackCache.clearLabels();
       }
     }
   }
@@ -450,7 +546,11 @@ static void renderFeaturesDbList(const char* title, const std::string& filename,
   std::vector<std::vector<double>>& features,
   float height) {
   ImGui::Text("%s", title);
-  if (ImGui::Button("Reload")) loadTrainingData(filename, labels, features);
+  if (ImGui::Button("Reload")) {
+    loadTrainingData(filename, labels, features);
+    g_app.train_index.build(labels, features);
+    g_app.trackCache.clearLabels();
+  }
   ImGui::SameLine();
   ImGui::Text("(%zu)", labels.size());
   ImGui::BeginChild(title, ImVec2(-1, height), true, ImGuiWindowFlags_NoScrollbar);
@@ -470,6 +570,8 @@ static void renderFeaturesDbList(const char* title, const std::string& filename,
       labels.erase(labels.begin() + i);
       features.erase(features.begin() + i);
       rewriteFeaturesCsv(filename, labels, features);
+      g_app.train_index.build(labels, features);
+      g_app.trackCache.clearLabels();
       i--;
     }
     ImGui::PopID();
@@ -481,6 +583,9 @@ static void renderCnnDbList(const char* title, const std::string& filename, floa
   ImGui::Text("%s", title);
   if (ImGui::Button("Reload##cnn")) {
     loadTrainingData(filename, g_app.cnn_train_labels, g_app.cnn_train_features);
+    g_app.cnn_index.loadOrBuild(g_app.cnn_index_filename, g_app.cnn_train_labels, g_app.cnn_train_features);
+    refreshCnnSearch();
+    g_app.trackCache.clearLabels();
   }
   ImGui::SameLine();
   ImGui::Text("(%zu)", g_app.cnn_train_labels.size());
@@ -501,6 +606,10 @@ static void renderCnnDbList(const char* title, const std::string& filename, floa
       g_app.cnn_train_labels.erase(g_app.cnn_train_labels.begin() + i);
       g_app.cnn_train_features.erase(g_app.cnn_train_features.begin() + i);
       rewriteCnnCsv(filename, g_app.cnn_train_labels, g_app.cnn_train_features);
+      g_app.cnn_index.build(g_app.cnn_train_labels, g_app.cnn_train_features); // no deletes in the graph
+      g_app.cnn_index.save(g_app.cnn_index_filename);
+      refreshCnnSearch();
+      g_app.trackCache.clearLabels();
       i--;
     }
     ImGui::PopID();
@@ -607,61 +716,65 @@ static void processFrame() {
   g_app.cap >> g_app.frame;
   if (g_app.frame.empty()) return;
 
-  cv::Mat thresh = g_app.auto_mode ? thresholdImage(g_app.frame) : thresholdImage(g_app.frame, g_app.manual_thresh);
-  cv::Mat cleaned = cleanupBinary(thresh);
-  g_app.segmented = segmentRegions(cleaned, g_app.regions, g_app.labelMap);
-
-  for (auto& r : g_app.regions)
-    computeRegionFeatures(g_app.labelMap, r);
-
-  if (!g_app.cnn_net.empty()) {
-    for (auto& r : g_app.regions) {
-      cv::Mat embImg;
-      prepEmbeddingImage(g_app.frame, embImg, (int)r.centroid.x, (int)r.centroid.y, r.theta, r.uMin, r.uMax, r.vMin, r.vMax, 0);
-      if (!embImg.empty() && embImg.cols > 0 && embImg.rows > 0) {
-        cv::Mat embedding;
-        getEmbedding(embImg, embedding, g_app.cnn_net, 0);
-        r.embeddingVector.clear();
-        for (int i = 0; i < embedding.cols; i++)
-          r.embeddingVector.push_back(embedding.at<float>(0, i));
-      }
-    }
-  }
+  g_app.thresh = g_app.auto_mode
+    ? thresholdImage(g_app.frame, -1, g_app.local_thresh ? AUTO_THRESH_LOCAL : AUTO_THRESH_HISTOGRAM, &g_app.auto_thresh)
+    : thresholdImage(g_app.frame, g_app.manual_thresh);
+  cleanupBinary(g_app.thresh, g_app.cleaned, g_app.open_size, g_app.close_size);
+  g_app.segmented = segmentRegions(g_app.cleaned, g_app.regions, g_app.labelMap, g_app.tracker);
+
+  g_app.trackCache.lookup(g_app.regions);
+  computeAllRegionFeatures(g_app.labelMap, g_app.regions);
 
-  cv::Mat show;
+  // CNN embeddings only when something reads them: CNN view, training or evaluation
+  g_app.embedder.nextFrame();
+  g_app.embedder.setDemand(EMBED_FOR_DISPLAY, g_app.display_mode == 6);
+  g_app.embedder.setDemand(EMBED_FOR_TRAINING, g_app.training_mode);
+  g_app.embedder.setDemand(EMBED_FOR_EVAL, g_app.eval_mode);
+  g_app.embedder.embed(g_app.frame, g_app.regions);
+
+  cv::Mat& show = g_app.show;
   switch (g_app.display_mode) {
     case 0:
       cv::cvtColor(g_app.frame, show, cv::COLOR_BGR2GRAY);
       cv::cvtColor(show, show, cv::COLOR_GRAY2BGR);
       break;
     case 1:
-      cv::cvtColor(thresh, show, cv::COLOR_GRAY2BGR);
+      cv::cvtColor(g_app.thresh, show, cv::COLOR_GRAY2BGR);
       break;
     case 2:
-      cv::cvtColor(cleaned, show, cv::COLOR_GRAY2BGR);
+      cv::cvtColor(g_app.cleaned, show, cv::COLOR_GRAY2BGR);
       break;
     case 3:
       show = g_app.segmented.clone();
       break;
     case 4:
-      show = colorizeRegions(g_app.labelMap, g_app.regions);
+      colorizeRegions(g_app.labelMap, g_app.regions, show);
       drawFeatures(show, g_app.regions);
       break;
     case 5:
-      show = colorizeRegions(g_app.labelMap, g_app.regions);
+      colorizeRegions(g_app.labelMap, g_app.regions, show);
       drawFeatures(show, g_app.regions);
-      classifyAndLabel(show, g_app.regions, g_app.train_labels, g_app.train_features);
+      classifyAndLabel(show, g_app.regions, g_app.train_index);
       break;
     case 6:
-      show = colorizeRegions(g_app.labelMap, g_app.regions);
+      colorizeRegions(g_app.labelMap, g_app.regions, show);
       drawFeatures(show, g_app.regions);
-      classifyAndLabelCNN(show, g_app.regions, g_app.cnn_train_labels, g_app.cnn_train_features);
+      if (g_app.cnn_search == CNN_SEARCH_PQ) {
+        classifyAndLabelCNN(show, g_app.regions, g_app.cnn_pq, &g_app.cnn_train_features);
+      } else if (g_app.cnn_search == CNN_SEARCH_EXACT) {
+        classifyAndLabelCNN(show, g_app.regions, g_app.cnn_exact);
+      } else {
+        classifyAndLabelCNN(show, g_app.regions, g_app.cnn_index);
+      }
       break;
     default:
-      cv::cvtColor(cleaned, show, cv::COLOR_GRAY2BGR);
+      cv::cvtColor(g_app.cleaned, show, cv::COLOR_GRAY2BGR);
       break;
   }
 
+  // remember this frame's features, embeddings and labels per track
+  g_app.trackCache.store(g_app.regions);
+
   freeTexture(g_app.texOriginal);
   freeTexture(g_app.texResult);
   g_app.texOriginal = matToTexture(g_app.frame, g_app.texOriginalW, g_app.texOriginalH);
@@ -683,6 +796,8 @@ int main(int argc, char* argv[]) {
   g_app.projectRoot = std::filesystem::path(argv[0]).parent_path().parent_path();
   g_app.db_filename = (g_app.projectRoot / "data" / "objects_db.csv").string();
   g_app.cnn_db_filename = (g_app.projectRoot / "data" / "objects_cnn_db.csv").string();
+  g_app.cnn_index_filename = (g_app.projectRoot / "data" / "objects_cnn_db.hnsw").string();
+  g_app.cnn_pq_filename = (g_app.projectRoot / "data" / "objects_cnn_db.pq").string();
   g_app.cnn_model_path = (g_app.projectRoot / "data" / "CNN" / "resnet18-v2-7.onnx").string();
 
   g_app.camNum = (argc > 1) ? atoi(argv[1]) : 0;
@@ -696,12 +811,16 @@ int main(int argc, char* argv[]) {
   g_app.cap.set(cv::CAP_PROP_FRAME_HEIGHT, 480);
 
   loadTrainingData(g_app.db_filename, g_app.train_labels, g_app.train_features);
+  g_app.train_index.setPruning(true); // class prototypes skip classes that can't hold the nearest example
+  g_app.cnn_exact.setEarlyAbandon(true); // rows that can't win stop early, same results
+  g_app.train_index.build(g_app.train_labels, g_app.train_features);
   loadTrainingData(g_app.cnn_db_filename, g_app.cnn_train_labels, g_app.cnn_train_features);
+  g_app.cnn_index.loadOrBuild(g_app.cnn_index_filename, g_app.cnn_train_labels, g_app.cnn_train_features);
 
   try {
-    g_app.cnn_net = cv::dnn::readNetFromONNX(g_app.cnn_model_path);
+    g_app.embedder.start(g_app.cnn_model_path);
   } catch (const cv::Exception&) {
-    g_app.cnn_net = cv::dnn::Net();
+    g_app.embedder.stop();
   }
 
   float xscale = 1.0f, yscale = 1.0f;
@@ -791,6 +910,7 @@ int main(int argc, char* argv[]) {
   freeTexture(g_app.texOriginal);
   freeTexture(g_app.texResult);
   g_app.cap.release();
+  g_app.embedder.stop();
   ImGui_ImplOpenGL2_Shutdown();
   ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
@@ -0,0 +1,366 @@
+/*
+  Parker Cai
+  February 22, 2026
+  CS5330 - Project 3: Real-time 2-D Object Recognition
+
+  HNSW graph (Malkov & Yashunin) over the CNN embedding DB: layered proximity graphs,
+  greedy descent through the sparse upper layers, beam search (ef) on the bottom one.
+*/
+
+#include "hnsw_index.h"
+#include "index_file.h"
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <string>
+#include <queue>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+constexpr char HNSW_MAGIC[8] = { 'O', 'R', '2', 'D', 'H', 'N', 'S', 'W' };
+constexpr uint32_t HNSW_VERSION = 1;
+constexpr double HNSW_MIN_UNIFORM = 1e-12; // floor of the level draw, so levels stay bounded
+
+HnswIndex::HnswIndex(int M, int efConstruction, int ef)
+  : M(std::max(2, M)), maxM0(2 * std::max(2, M)), efConstruction(std::max(1, efConstruction)),
+    ef(std::max(1, ef)), levelMult(1.0 / std::log((double)std::max(2, M))), rng(42) {
+}
+
+void HnswIndex::clear() {
+  numDims = 0;
+  stride = 0;
+  data.clear();
+  labels.clear();
+  links.clear();
+  entryPoint = -1;
+  maxLevel = -1;
+  rng.seed(42); // same DB -> same graph
+}
+
+void HnswIndex::build(const std::vector<std::string>& train_labels,
+  const std::vector<std::vector<float>>& train_features) {
+  clear();
+  for (size_t i = 0; i < train_features.size() && i < train_labels.size(); i++) {
+    add(train_labels[i], train_features[i]);
+  }
+}
+
+float HnswIndex::dist(const float* q, int id) const {
+  return squaredL2(q, vec(id), stride);
+}
+
+float HnswIndex::dist(const float* q, int id, float bound) const {
+  return squaredL2Bounded(q, vec(id), stride, bound);
+}
+
+/*
+  Greedy walk on each layer from fromLevel down to toLevel (exclusive): move to the
+  closest neighbor until none is closer.
+*/
+int HnswIndex::greedyDescend(const float* q, int ep, int fromLevel, int toLevel) const {
+  float d = dist(q, ep);
+  for (int level = fromLevel; level > toLevel; level--) {
+    bool moved = true;
+    while (moved) {
+      moved = false;
+      for (int nb : links[ep][level]) {
+        float dn = dist(q, nb, d); // only needed if it beats d
+        if (dn < d) {
+          d = dn;
+          ep = nb;
+          moved = true;
+        }
+      }
+    }
+  }
+  return ep;
+}
+
+/*
+  Beam search on one layer: expand the closest unexpanded candidate until it is farther
+  than the worst of the efLayer best found so far. Returns those, closest first.
+*/
+std::vector<HnswIndex::DistId> HnswIndex::searchLayer(const float* q, const std::vector<DistId>& entry, int efLayer, int level) const {
+  std::vector<uint8_t> visited(labels.size(), 0);
+  std::priority_queue<DistId, std::vector<DistId>, std::greater<DistId>> candidates; // closest on top
+  std::priority_queue<DistId> best; // farthest on top
+
+  for (const DistId& e : entry) {
+    visited[e.second] = 1;
+    candidates.push(e);
+    best.push(e);
+  }
+  while ((int)best.size() > efLayer) best.pop();
+
+  while (!candidates.empty()) {
+    DistId c = candidates.top();
+    if (c.first > best.top().first && (int)best.size() >= efLayer) break;
+    candidates.pop();
+
+    for (int nb : links[c.second][level]) {
+      if (visited[nb]) continue;
+      visited[nb] = 1;
+      // once the beam is full, only a distance below its worst one matters
+      const bool full = (int)best.size() >= efLayer;
+      float d = full ? dist(q, nb, best.top().first) : dist(q, nb);
+      if (!full || d < best.top().first) {
+        candidates.push({ d, nb });
+        best.push({ d, nb });
+        if ((int)best.size() > efLayer) best.pop();
+      }
+    }
+  }
+
+  std::vector<DistId> result(best.size());
+  for (int i = (int)result.size() - 1; i >= 0; i--) {
+    result[i] = best.top();
+    best.pop();
+  }
+  return result;
+}
+
+/*
+  Neighbor selection heuristic: take candidates closest first, but skip one that is
+  closer to an already selected neighbor than to the new node. Keeps links spread out
+  in different directions, which keeps the graph navigable for clustered data.
+*/
+std::vector<int> HnswIndex::selectNeighbors(std::vector<DistId> candidates, int maxLinks) const {
+  std::sort(candidates.begin(), candidates.end());
+  std::vector<int> selected;
+  for (const DistId& c : candidates) {
+    if ((int)selected.size() >= maxLinks) break;
+    bool keep = true;
+    for (int s : selected) {
+      if (squaredL2(vec(c.second), vec(s), stride) < c.first) {
+        keep = false;
+        break;
+      }
+    }
+    if (keep) selected.push_back(c.second);
+  }
+  return selected;
+}
+
+int HnswIndex::add(const std::string& label, const std::vector<float>& embedding) {
+  if (labels.empty() && numDims == 0) {
+    if (embedding.empty()) return -1;
+    numDims = (int)embedding.size();
+    stride = embeddingStride(numDims);
+  }
+  if ((int)embedding.size() != numDims) return -1;
+
+  const int id = (int)labels.size();
+  data.resize(data.size() + stride, 0.0f);
+  std::copy(embedding.begin(), embedding.end(), data.begin() + (size_t)id * stride);
+  labels.push_back(classLabels().intern(label));
+
+  // random level, P(level >= l) = M^-l
+  std::uniform_real_distribution<double> uni(0.0, 1.0);
+  int level = (int)(-std::log(std::max(uni(rng), HNSW_MIN_UNIFORM)) * levelMult);
+  links.emplace_back(level + 1);
+
+  if (entryPoint < 0) {
+    entryPoint = id;
+    maxLevel = level;
+    return id;
+  }
+
+  const float* q = vec(id);
+  int ep = greedyDescend(q, entryPoint, maxLevel, level);
+  std::vector<DistId> entry{ { dist(q, ep), ep } };
+
+  for (int lc = std::min(level, maxLevel); lc >= 0; lc--) {
+    std::vector<DistId> found = searchLayer(q, entry, efConstruction, lc);
+    const int maxLinks = lc == 0 ? maxM0 : M;
+    std::vector<int> neighbors = selectNeighbors(found, M);
+    links[id][lc] = neighbors;
+
+    // back links, pruned with the same heuristic when a node has too many
+    for (int nb : neighbors) {
+      std::vector<int>& nbLinks = links[nb][lc];
+      nbLinks.push_back(id);
+      if ((int)nbLinks.size() > maxLinks) {
+        std::vector<DistId> cand;
+        cand.reserve(nbLinks.size());
+        for (int x : nbLinks) cand.push_back({ squaredL2(vec(nb), vec(x), stride), x });
+        nbLinks = selectNeighbors(cand, maxLinks);
+      }
+    }
+    entry = found;
+  }
+
+  if (level > maxLevel) {
+    maxLevel = level;
+    entryPoint = id;
+  }
+  return id;
+}
+
+std::vector<std::pair<float, int>> HnswIndex::search(const std::vector<float>& query, int k) const {
+  std::vector<DistId> result;
+  if (labels.empty() || k < 1 || (int)query.size() != numDims) return result;
+
+  auto q = paddedEmbedding(query, stride);
+  const int efSearch = std::max(ef, k);
+
+  if ((int)labels.size() <= efSearch) {
+    // small DB: the exact scan is cheaper than the graph walk
+    result.reserve(labels.size());
+    for (int i = 0; i < (int)labels.size(); i++) result.push_back({ dist(q.data(), i), i });
+    std::sort(result.begin(), result.end());
+  }
+  else {
+    int ep = greedyDescend(q.data(), entryPoint, maxLevel, 0);
+    result = searchLayer(q.data(), { { dist(q.data(), ep), ep } }, efSearch, 0);
+  }
+  if ((int)result.size() > k) result.resize(k);
+  return result;
+}
+
+int HnswIndex::nearest(const std::vector<float>& query, float& ssd) const {
+  std::vector<DistId> r = search(query, 1);
+  if (r.empty()) {
+    ssd = std::numeric_limits<float>::infinity();
+    return -1;
+  }
+  ssd = r[0].first;
+  return r[0].second;
+}
+
+int HnswIndex::classify(const std::vector<float>& query, float& accuracy) const {
+  float min_dist;
+  int best_idx = nearest(query, min_dist);
+  if (best_idx == -1) {
+    accuracy = 0.0f;
+    return LABEL_UNKNOWN;
+  }
+
+  accuracy = cnnConfidence(min_dist, numDims);
+  return labels[best_idx];
+}
+
+/*
+  File layout (little endian, as written by this machine):
+    magic[8] version M maxM0 efConstruction numDims count entryPoint maxLevel   (uint32/int32)
+    per node: labelLength label levels embedding[numDims] { linkCount links[] } per level
+*/
+bool HnswIndex::save(const std::string& filename) const {
+  std::ofstream out(filename, std::ios::binary);
+  if (!out.is_open()) return false;
+
+  out.write(HNSW_MAGIC, sizeof(HNSW_MAGIC));
+  writePod(out, HNSW_VERSION);
+  writePod(out, (int32_t)M);
+  writePod(out, (int32_t)maxM0);
+  writePod(out, (int32_t)efConstruction);
+  writePod(out, (int32_t)numDims);
+  writePod(out, (int32_t)labels.size());
+  writePod(out, (int32_t)entryPoint);
+  writePod(out, (int32_t)maxLevel);
+
+  for (int id = 0; id < (int)labels.size(); id++) {
+    const std::string& name = classLabels().name(labels[id]); // names on disk, ids are per run
+    writePod(out, (int32_t)name.size());
+    out.write(name.data(), name.size());
+    writePod(out, (int32_t)links[id].size());
+    out.write(reinterpret_cast<const char*>(vec(id)), sizeof(float) * numDims);
+    for (const std::vector<int>& l : links[id]) {
+      writePod(out, (int32_t)l.size());
+      for (int nb : l) writePod(out, (int32_t)nb);
+    }
+  }
+  return (bool)out;
+}
+
+bool HnswIndex::load(const std::string& filename) {
+  clear();
+  std::ifstream in(filename, std::ios::binary);
+  if (!in.is_open()) return false;
+
+  char magic[sizeof(HNSW_MAGIC)];
+  uint32_t version;
+  int32_t m, m0, efc, dims, count, ep, top;
+  if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, HNSW_MAGIC, sizeof(magic)) != 0) return false;
+  if (!readPod(in, version) || version != HNSW_VERSION) return false;
+  if (!readPod(in, m) || !readPod(in, m0) || !readPod(in, efc) || !readPod(in, dims) ||
+      !readPod(in, count) || !readPod(in, ep) || !readPod(in, top)) return false;
+  if (m < 2 || m0 < m || efc < 1 || dims < 0 || count < 0 || ep >= count) return false;
+
+  // sizes come from the file: no more than it can hold, before allocating anything
+  const std::streamoff start = in.tellg();
+  in.seekg(0, std::ios::end);
+  const long long bytes = (long long)(in.tellg() - start);
+  in.seekg(start);
+  const long long nodeBytes = 3 * sizeof(int32_t) + (long long)sizeof(float) * dims; // len, levels, one link count
+  if (count > 0 && nodeBytes * count > bytes) return false;
+  const int maxLevels = (int)(-std::log(HNSW_MIN_UNIFORM) / std::log((double)m)) + 1; // what add() can draw
+
+  M = m;
+  maxM0 = m0;
+  efConstruction = efc;
+  levelMult = 1.0 / std::log((double)M);
+  numDims = dims;
+  stride = embeddingStride(numDims);
+  data.assign((size_t)count * stride, 0.0f);
+  labels.resize(count);
+  links.resize(count);
+
+  bool ok = true;
+  for (int id = 0; ok && id < count; id++) {
+    int32_t len, levels;
+    ok = readPod(in, len) && len >= 0 && len <= bytes;
+    if (ok) {
+      std::string name(len, '\0');
+      ok = (bool)in.read(name.data(), len);
+      if (ok) labels[id] = classLabels().intern(name);
+    }
+    ok = ok && readPod(in, levels) && levels >= 1 && levels <= maxLevels;
+    ok = ok && (bool)in.read(reinterpret_cast<char*>(data.data() + (size_t)id * stride), sizeof(float) * numDims);
+    if (ok) links[id].resize(levels);
+    for (int l = 0; ok && l < levels; l++) {
+      int32_t n;
+      ok = readPod(in, n) && n >= 0 && n <= count;
+      if (ok) links[id][l].resize(n);
+      for (int k = 0; ok && k < n; k++) {
+        int32_t nb;
+        ok = readPod(in, nb) && nb >= 0 && nb < count;
+        if (ok) links[id][l][k] = nb;
+      }
+    }
+  }
+  // every link must point at a node that has that layer
+  for (int id = 0; ok && id < count; id++) {
+    for (int l = 0; ok && l < (int)links[id].size(); l++) {
+      for (int nb : links[id][l]) ok = ok && l < (int)links[nb].size();
+    }
+  }
+  if (!ok || (count > 0 && (ep < 0 || top != (int)links[ep].size() - 1))) {
+    clear();
+    return false;
+  }
+
+  entryPoint = ep;
+  maxLevel = top;
+  return true;
+}
+
+bool HnswIndex::loadOrBuild(const std::string& filename,
+  const std::vector<std::string>& train_labels,
+  const std::vector<std::vector<float>>& train_features) {
+  bool same = load(filename) && labels.size() == train_labels.size();
+  for (size_t i = 0; same && i < train_labels.size(); i++) {
+    same = classLabels().name(labels[i]) == train_labels[i];
+  }
+  for (size_t i = 0; same && i < train_features.size(); i++) {
+    same = (int)train_features[i].size() == numDims &&
+      std::equal(train_features[i].begin(), train_features[i].end(), vec((int)i));
+  }
+  if (same) return true;
+
+  build(train_labels, train_features);
+  save(filename);
+  return false;
+}
@@ -9,6 +9,13 @@
 
 #include "or2d.h"
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OR2D_SSE2 1
+#endif
 
 using namespace cv;
 
@@ -88,6 +95,290 @@ Mat dilate(const Mat& src) {
   return result;
 }
 
+/*
+  Packed binary images - 64 pixels per uint64_t word
+
+  A 3x3 erode/dilate on packed rows is separable:
+    vertical:   v = above & cur & below        (OR for dilation)
+    horizontal: v & (v << 1) & (v >> 1)       with the carry bit taken from the
+                                               neighboring words
+  so one word of output (64 pixels) costs a handful of instructions.
+*/
+
+// mask of the valid bits in the last word of a row, excluding the last column
+// (the last column is border and always 0 in the output, like erode()/dilate())
+static uint64_t lastWordInteriorMask(int cols) {
+  int wordsPerRow = (cols + 63) / 64;
+  int lastCol = cols - 1 - 64 * (wordsPerRow - 1); // bit index of the last column
+  return (lastCol <= 0) ? 0 : ((~0ULL) >> (64 - lastCol));
+}
+
+// one output row of a packed 3x3 erosion (isErode) or dilation
+static void morphRow3(const uint64_t* above, const uint64_t* cur, const uint64_t* below,
+  uint64_t* out, int words, uint64_t lastMask, bool isErode) {
+  uint64_t prev = 0;
+  uint64_t mid = isErode ? (above[0] & cur[0] & below[0]) : (above[0] | cur[0] | below[0]);
+  for (int w = 0; w < words; w++) {
+    uint64_t next = 0;
+    if (w + 1 < words) {
+      next = isErode ? (above[w + 1] & cur[w + 1] & below[w + 1]) : (above[w + 1] | cur[w + 1] | below[w + 1]);
+    }
+    // bit c of left/right holds column c-1 / c+1
+    uint64_t left = (mid << 1) | (prev >> 63);
+    uint64_t right = (mid >> 1) | (next << 63);
+    out[w] = isErode ? (mid & left & right) : (mid | left | right);
+    prev = mid;
+    mid = next;
+  }
+  // first and last column are border
+  out[0] &= ~1ULL;
+  out[words - 1] &= lastMask;
+}
+
+static void morphPacked3(const PackedBinary& src, PackedBinary& dst, bool isErode) {
+  dst.create(src.rows, src.cols); // all zeros, including the border rows
+  if (src.rows < 3 || src.cols < 3) {
+    return;
+  }
+  uint64_t lastMask = lastWordInteriorMask(src.cols);
+  parallelStripes(src.rows - 2, [&](int rowBegin, int rowEnd) {
+    for (int r = rowBegin + 1; r < rowEnd + 1; r++) {
+      morphRow3(src.row(r - 1), src.row(r), src.row(r + 1), dst.row(r), src.wordsPerRow, lastMask, isErode);
+    }
+  });
+}
+
+void erodePacked(const PackedBinary& src, PackedBinary& dst) {
+  morphPacked3(src, dst, true);
+}
+
+void dilatePacked(const PackedBinary& src, PackedBinary& dst) {
+  morphPacked3(src, dst, false);
+}
+
+// pack one CV_8U row: bit set where the pixel is nonzero
+static void packRow(const uchar* src, uint64_t* dst, int cols) {
+  int words = (cols + 63) / 64;
+  for (int w = 0; w < words; w++) {
+    int c0 = 64 * w;
+    int n = std::min(64, cols - c0);
+    uint64_t bits = 0;
+    int i = 0;
+#ifdef OR2D_SSE2
+    // movemask grabs 16 "is zero" flags at a time
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(src + c0 + i));
+      uint64_t isZero = (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+      bits |= (~isZero & 0xFFFFULL) << i;
+    }
+#endif
+    for (; i < n; i++) {
+      bits |= (uint64_t)(src[c0 + i] != 0) << i;
+    }
+    dst[w] = bits;
+  }
+}
+
+void packBinary(const Mat& src, PackedBinary& dst) {
+  CV_Assert(src.type() == CV_8UC1);
+  dst.create(src.rows, src.cols);
+  parallelStripes(src.rows, [&](int rowBegin, int rowEnd) {
+    for (int r = rowBegin; r < rowEnd; r++) {
+      packRow(src.ptr<uchar>(r), dst.row(r), src.cols);
+    }
+  });
+}
+
+// unpack one row: 8 bits at a time through a 256-entry table of 8-byte patterns
+static void unpackRow(const uint64_t* src, uchar* dst, int cols) {
+  static const std::vector<uint64_t> expand = [] {
+    std::vector<uint64_t> table(256);
+    for (int b = 0; b < 256; b++) {
+      uint64_t v = 0;
+      for (int i = 0; i < 8; i++) {
+        if (b & (1 << i)) v |= 0xFFULL << (8 * i);
+      }
+      table[b] = v;
+    }
+    return table;
+  }();
+
+  int c = 0;
+  for (; c + 8 <= cols; c += 8) {
+    uint64_t bytes = expand[(src[c >> 6] >> (c & 63)) & 0xFF];
+    memcpy(dst + c, &bytes, 8); // byte i -> column c+i on little-endian targets
+  }
+  for (; c < cols; c++) {
+    dst[c] = ((src[c >> 6] >> (c & 63)) & 1) ? 255 : 0;
+  }
+}
+
+void unpackBinary(const PackedBinary& src, Mat& dst) {
+  dst.create(src.rows, src.cols, CV_8U);
+  parallelStripes(src.rows, [&](int rowBegin, int rowEnd) {
+    for (int r = rowBegin; r < rowEnd; r++) {
+      unpackRow(src.row(r), dst.ptr<uchar>(r), src.cols);
+    }
+  });
+}
+
+/*
+  Arbitrary-size rectangular structuring elements - van Herk / Gil-Werman
+
+  A running min (erode) or max (dilate) over a window of k values:
+    split the line into blocks of k,
+    g[j] = op of the block from its start up to j    (prefix)
+    h[j] = op of the block from j up to its end      (suffix)
+    window [s, s+k-1] spans at most two blocks, so its result is op(h[s], g[s+k-1])
+  That is 3 compares per value no matter how big k is. Rectangles are separable:
+  a horizontal pass on each row, then a vertical pass done one whole row at a time.
+*/
+
+template <bool IsErode>
+static inline uchar pickMinMax(uchar a, uchar b) {
+  return IsErode ? std::min(a, b) : std::max(a, b);
+}
+
+// 1-D vHGW over n values: out[s] = op(src[s .. s+k-1]) for s in [0, n-k]
+template <bool IsErode>
+static void vhgwLine(const uchar* src, uchar* out, int n, int k, uchar* g, uchar* h) {
+  for (int b = 0; b < n; b += k) {
+    int e = std::min(b + k, n);
+    g[b] = src[b];
+    for (int j = b + 1; j < e; j++) g[j] = pickMinMax<IsErode>(g[j - 1], src[j]);
+    h[e - 1] = src[e - 1];
+    for (int j = e - 2; j >= b; j--) h[j] = pickMinMax<IsErode>(h[j + 1], src[j]);
+  }
+  for (int s = 0; s + k <= n; s++) {
+    out[s] = pickMinMax<IsErode>(h[s], g[s + k - 1]);
+  }
+}
+
+// elementwise op of two rows
+template <bool IsErode>
+static void pickRows(const uchar* a, const uchar* b, uchar* out, int n) {
+  for (int c = 0; c < n; c++) out[c] = pickMinMax<IsErode>(a[c], b[c]);
+}
+
+template <bool IsErode>
+static Mat morphRect(const Mat& src, Size ksize) {
+  CV_Assert(src.type() == CV_8UC1);
+  const int rows = src.rows;
+  const int cols = src.cols;
+  const int kw = std::max(1, ksize.width);
+  const int kh = std::max(1, ksize.height);
+  const int ax = kw / 2; // anchor
+  const int ay = kh / 2;
+
+  Mat result = Mat::zeros(src.size(), CV_8U);
+  if (cols < kw || rows < kh) {
+    return result; // element never fits
+  }
+
+  // horizontal pass; columns whose window sticks out of the image stay 0
+  Mat horiz = Mat::zeros(src.size(), CV_8U);
+  parallelStripes(rows, [&](int rowBegin, int rowEnd) {
+    std::vector<uchar> g(cols), h(cols);
+    for (int r = rowBegin; r < rowEnd; r++) {
+      vhgwLine<IsErode>(src.ptr<uchar>(r), horiz.ptr<uchar>(r) + ax, cols, kw, g.data(), h.data());
+    }
+  });
+  if (kh == 1) {
+    return horiz;
+  }
+
+  // vertical pass, whole rows at a time: prefix/suffix rows per block of kh rows
+  // (blocks are independent, stripes are whole blocks)
+  Mat gRows(src.size(), CV_8U), hRows(src.size(), CV_8U);
+  const int blocks = (rows + kh - 1) / kh;
+  parallelStripes(blocks, [&](int blockBegin, int blockEnd) {
+    for (int b = blockBegin * kh; b < std::min(rows, blockEnd * kh); b += kh) {
+      int e = std::min(b + kh, rows);
+      memcpy(gRows.ptr<uchar>(b), horiz.ptr<uchar>(b), cols);
+      for (int r = b + 1; r < e; r++) {
+        pickRows<IsErode>(gRows.ptr<uchar>(r - 1), horiz.ptr<uchar>(r), gRows.ptr<uchar>(r), cols);
+      }
+      memcpy(hRows.ptr<uchar>(e - 1), horiz.ptr<uchar>(e - 1), cols);
+      for (int r = e - 2; r >= b; r--) {
+        pickRows<IsErode>(hRows.ptr<uchar>(r + 1), horiz.ptr<uchar>(r), hRows.ptr<uchar>(r), cols);
+      }
+    }
+  }, std::max(1, getStripeGrain() / kh));
+
+  // rows whose window sticks out of the image stay 0
+  parallelStripes(rows - kh + 1, [&](int sBegin, int sEnd) {
+    for (int s = sBegin; s < sEnd; s++) {
+      pickRows<IsErode>(hRows.ptr<uchar>(s), gRows.ptr<uchar>(s + kh - 1), result.ptr<uchar>(s + ay), cols);
+    }
+  });
+
+  return result;
+}
+
+Mat erodeRect(const Mat& src, Size ksize) {
+  return morphRect<true>(src, ksize);
+}
+
+Mat dilateRect(const Mat& src, Size ksize) {
+  return morphRect<false>(src, ksize);
+}
+
+/*
+  Streaming 3x3 open + close
+
+  The four packed operators (erode, dilate, dilate, erode) are chained through
+  3-row rings instead of full-frame intermediates. Stage k produces row t-k at
+  step t, which only needs rows t-k-1 .. t-k+1 of stage k-1, all of them already
+  in its ring. Each input row is packed once and the cleaned row is unpacked
+  4 rows later, so the only frame-sized buffer is the output.
+
+  For output rows [rowBegin, rowEnd) stage k needs rows [rowBegin-4+k, rowEnd+4-k),
+  so a stripe reads a 4-row halo on each side and stripes run independently.
+*/
+static void cleanupPacked3Stripe(const Mat& binary, Mat& cleaned, int rowBegin, int rowEnd) {
+  const int rows = binary.rows;
+  const int cols = binary.cols;
+  const int words = (cols + 63) / 64;
+  const uint64_t lastMask = lastWordInteriorMask(cols);
+  const bool isErode[4] = { true, false, false, true }; // opening then closing
+
+  // ring[0]: packed input rows, ring[k]: output rows of stage k (1..4), row j in slot j % 3
+  std::vector<uint64_t> ring(5 * 3 * (size_t)words);
+  auto slot = [&](int stage, int r) { return ring.data() + ((size_t)stage * 3 + r % 3) * words; };
+
+  for (int t = std::max(0, rowBegin - 4); t < std::min(rows, rowEnd + 4) + 4; t++) {
+    if (t < std::min(rows, rowEnd + 4)) {
+      packRow(binary.ptr<uchar>(t), slot(0, t), cols);
+    }
+    for (int k = 1; k <= 4; k++) {
+      int j = t - k;
+      if (j < std::max(0, rowBegin - 4 + k) || j >= std::min(rows, rowEnd + 4 - k)) continue;
+      uint64_t* out = slot(k, j);
+      if (j == 0 || j == rows - 1) {
+        memset(out, 0, words * sizeof(uint64_t)); // border rows
+      }
+      else {
+        morphRow3(slot(k - 1, j - 1), slot(k - 1, j), slot(k - 1, j + 1), out, words, lastMask, isErode[k - 1]);
+      }
+      if (k == 4) {
+        unpackRow(out, cleaned.ptr<uchar>(j), cols);
+      }
+    }
+  }
+}
+
+static void cleanupPacked3(const Mat& binary, Mat& cleaned) {
+  cleaned.create(binary.rows, binary.cols, CV_8U);
+  if (binary.rows < 3 || binary.cols < 3) {
+    cleaned.setTo(Scalar(0));
+    return;
+  }
+  parallelStripes(binary.rows, [&](int rowBegin, int rowEnd) {
+    cleanupPacked3Stripe(binary, cleaned, rowBegin, rowEnd);
+  });
+}
+
 /*
   Main cleanup function
 
@@ -95,19 +386,46 @@ Mat dilate(const Mat& src) {
   - Opening = erode then dilate (gets rid of noise)
   - Closing = dilate then erode (fills holes)
 
-  Input: messy binary image
-  Output: cleaned up version
+  The default 3x3 elements stream through the packed representation (64 pixels
+  per word); the output is identical to chaining erode()/dilate() on the byte image.
+  Other sizes use the van Herk/Gil-Werman filters, so a 15x15 closing costs
+  about the same as a 3x3 one.
+
+  Input: messy binary image, output image (reused when it already has the right size and type),
+         opening and closing element sizes
 */
-Mat cleanupBinary(const Mat& binary) {
-  Mat temp, cleaned;
+void cleanupBinary(const Mat& binary, Mat& cleaned, int openSize, int closeSize) {
+  CV_Assert(binary.type() == CV_8UC1);
+  if (openSize == 3 && closeSize == 3) {
+    cleanupPacked3(binary, cleaned);
+    return;
+  }
+
+  Mat temp = binary;
 
   // opening - remove noise spots
-  temp = erode(binary);
-  temp = dilate(temp);
+  if (openSize > 1) {
+    temp = erodeRect(temp, Size(openSize, openSize));
+    temp = dilateRect(temp, Size(openSize, openSize));
+  }
 
   // closing - fill holes
-  temp = dilate(temp);
-  cleaned = erode(temp);
+  if (closeSize > 1) {
+    temp = dilateRect(temp, Size(closeSize, closeSize));
+    temp = erodeRect(temp, Size(closeSize, closeSize));
+  }
+
+  temp.copyTo(cleaned);
+}
 
+/*
+  Same as above, returning a new image
+
+  Input: messy binary image
+  Output: cleaned up version
+*/
+Mat cleanupBinary(const Mat& binary, int openSize, int closeSize) {
+  Mat cleaned;
+  cleanupBinary(binary, cleaned, openSize, closeSize);
   return cleaned;
-}
\ No newline at end of file
+}
@@ -15,6 +15,9 @@
 #include <filesystem>
 #include "or2d.h"
 #include "utilities.h"   // for CNN embedding utilities
+#include "embedding_worker.h"
+#include "hnsw_index.h"
+#include "pq_index.h"
 
 /*
   Use the chrono time library to get the current time
@@ -27,6 +30,8 @@ double getTime() {
   return now_in_seconds;
 }
 
+// CnnSearch names for the 'k' key
+static const char* cnnSearchNames[] = { "HNSW", "compressed (PQ)", "exact (batched GEMM)" };
 
 /*
   Helper function to show the cli controls menu of the program.
@@ -36,11 +41,13 @@ void showHelp() {
   std::println("  q - quit");
   std::println("  s - save image");
   std::println("  a - toggle auto/manual");
+  std::println("  g - toggle global/local auto threshold");
   std::println("  t - toggle training mode");
   std::println("  n - save training sample (features)");
   std::println("  f - toggle CNN eval mode");
   std::println("  c - save CNN training sample (embedding)");
   std::println("  m - print CNN confusion matrix");
+  std::println("  k - cycle CNN search (HNSW / compressed PQ / exact)");
   std::println("  e - evaluation mode");
   std::println("  r - record evaluation result");
   std::println("  p - print confusion matrix");
@@ -48,6 +55,8 @@ void showHelp() {
   std::println("  l - auto-learn unknown object");
   std::println("  + - increase threshold");
   std::println("  - - decrease threshold");
+  std::println("  [ - smaller closing element");
+  std::println("  ] - larger closing element");
   std::println("  h - help");
   std::println("  0 - show original");
   std::println("  1 - show threshold");
@@ -102,6 +111,10 @@ int main(int argc, char** argv) {
   // variables for the program
   bool auto_mode = true;
   int manual_thresh = 120;
+  int auto_thresh = -1; // last auto threshold, warm-starts the next frame
+  bool local_thresh = false; // per-tile (adaptive) auto threshold for uneven lighting
+  int open_size = 3;  // opening element size (removes specks)
+  int close_size = 3; // closing element size (fills holes), larger parts need 7..15
   int display_mode = 2; // 0=original, 1=threshold, 2=cleaned, 3=segmented, 4=features, 5=classification, 6=CNN classification
   bool training_mode = false;
   bool eval_mode = false;
@@ -111,6 +124,10 @@ int main(int argc, char** argv) {
   cv::Mat frame;
   std::vector<RegionInfo> regions;
   cv::Mat segmented, labelMap;
+  RegionTracker tracker; // region track IDs / colors across frames
+  TrackCache trackCache; // reuses features, embeddings and labels of objects that did not move
+  cv::Mat cleaned; // kept across frames so cleanupBinary() reuses the buffer
+  cv::Mat show;    // result image, kept across frames so colorizeRegions() reuses the buffer
   // save the training data in a csv file with label and features
   std::string db_filename = (projectRoot / "data" / "objects_db.csv").string();
   std::string cnn_db_filename = (projectRoot / "data" / "objects_cnn_db.csv").string();
@@ -120,18 +137,35 @@ int main(int argc, char** argv) {
   std::vector<std::vector<double>> train_features;
   int num_train = loadTrainingData(db_filename, train_labels, train_features);
   std::println("Loaded {} hand-built feature examples", num_train);
+  FeatureIndex train_index(train_labels, train_features); // rebuilt whenever the DB changes
+  train_index.setPruning(true); // class prototypes skip classes that can't hold the nearest example
 
   // Load existing CNN training data (embeddings)
   std::vector<std::string> cnn_train_labels;
   std::vector<std::vector<float>> cnn_train_features;
   int num_cnn_train = loadTrainingData(cnn_db_filename, cnn_train_labels, cnn_train_features);
+
+  // Approximate nearest-neighbor graph over the CNN DB, kept on disk next to it
+  std::string cnn_index_filename = (projectRoot / "data" / "objects_cnn_db.hnsw").string();
+  HnswIndex cnn_index;
+  if (!cnn_index.loadOrBuild(cnn_index_filename, cnn_train_labels, cnn_train_features)) {
+    std::println("Built CNN index ({} embeddings)", cnn_index.size());
+  }
   std::println("Loaded {} CNN embedding examples", num_cnn_train);
 
+  // Product-quantized copy of the CNN DB (64 bytes per embedding), built when first selected
+  std::string cnn_pq_filename = (projectRoot / "data" / "objects_cnn_db.pq").string();
+  PqIndex cnn_pq;
+  // Exact copy for batched search (all regions in one GEMM), built when selected
+  EmbeddingIndex cnn_exact;
+  cnn_exact.setEarlyAbandon(true); // rows that can't win stop early, same results
+  int cnn_search = CNN_SEARCH_HNSW;
+
   // Load ResNet18 CNN model for computing embeddings
   std::string cnn_model_path = (projectRoot / "data" / "CNN" / "resnet18-v2-7.onnx").string();
-  cv::dnn::Net cnn_net;
+  EmbeddingWorker embedder; // runs the CNN off the capture loop
   try {
-    cnn_net = cv::dnn::readNetFromONNX(cnn_model_path);
+    embedder.start(cnn_model_path);
     std::println("ResNet18 CNN model loaded successfully.");
   } catch (const cv::Exception& e) {
     std::println("ERROR: Could not load CNN model from {}", cnn_model_path);
@@ -158,7 +192,8 @@ int main(int argc, char** argv) {
 
     // display the original frame with mode text overlay
     cv::Mat display = frame.clone();
-    std::string text = auto_mode ? "Auto" : "Manual=" + std::to_string(manual_thresh);
+    std::string text = !auto_mode ? "Manual=" + std::to_string(manual_thresh)
+      : local_thresh ? "Auto=Local" : "Auto=" + std::to_string(auto_thresh);
     cv::putText(display, text, cv::Point(10, 30), cv::FONT_HERSHEY_SIMPLEX, 0.7, cv::Scalar(0, 255, 0), 2);
     cv::imshow("Original", display);
 
@@ -187,52 +222,34 @@ int main(int argc, char** argv) {
     cv::imshow("Original", display);
 
     // do the processing
-    cv::Mat thresh, cleaned;
+    cv::Mat thresh;
     if (auto_mode) {
-      thresh = thresholdImage(frame);
+      thresh = thresholdImage(frame, -1, local_thresh ? AUTO_THRESH_LOCAL : AUTO_THRESH_HISTOGRAM, &auto_thresh);
     }
     else { // manual threshold mode
       thresh = thresholdImage(frame, manual_thresh);
     }
-    cleaned = cleanupBinary(thresh);
+    cleanupBinary(thresh, cleaned, open_size, close_size);
 
     // Segment regions for multi-object recognition
-    segmented = segmentRegions(cleaned, regions, labelMap);
+    segmented = segmentRegions(cleaned, regions, labelMap, tracker);
 
-    // Compute features for each region
-    for (auto& region : regions) {
-      computeRegionFeatures(labelMap, region);
-    }
+    // Reuse the results of tracks that have not moved
+    trackCache.lookup(regions);
 
-    // Compute CNN embeddings for each region
-    if (!cnn_net.empty()) {
-      for (auto& region : regions) {
-        // extract axis-aligned region of interest (ROI)
-        cv::Mat embImg;
-        prepEmbeddingImage(frame, embImg,
-          (int)region.centroid.x, (int)region.centroid.y,
-          region.theta,
-          region.uMin, region.uMax,
-          region.vMin, region.vMax, 0);
-
-        // compute the CNN embedding
-        if (!embImg.empty() && embImg.cols > 0 && embImg.rows > 0) { // check if the ROI is valid
-          cv::Mat embedding;
-          getEmbedding(embImg, embedding, cnn_net, 0);
-
-          // store embedding directly as float (native DNN precision)
-          region.embeddingVector.clear();
-          for (int i = 0; i < embedding.cols; i++) {
-            region.embeddingVector.push_back(embedding.at<float>(0, i));
-          }
-        }
-      }
-    }
+    // Compute features for all regions (one pass, cached regions are skipped)
+    computeAllRegionFeatures(labelMap, regions);
+
+    // CNN embeddings only when something reads them: the CNN view or CNN eval mode.
+    // Submitted to the worker, finished ones are attached to their tracks
+    embedder.nextFrame();
+    embedder.setDemand(EMBED_FOR_DISPLAY, display_mode == 6);
+    embedder.setDemand(EMBED_FOR_EVAL, cnn_eval_mode);
+    embedder.embed(frame, regions);
 
 
 
     // Show result based on display mode
-    cv::Mat show;
     std::string label;
     switch (display_mode) {
       case 0:
@@ -253,24 +270,31 @@ int main(int argc, char** argv) {
         label = "Segmented";
         break;
       case 4:
-        show = colorizeRegions(labelMap, regions);
+        colorizeRegions(labelMap, regions, show);
         drawFeatures(show, regions);
         label = "Features";
         break;
       case 5:
-        show = colorizeRegions(labelMap, regions);
+        colorizeRegions(labelMap, regions, show);
         if(unknown_detection) {
-          classifyAndLabelWithUnknown(show, regions, train_labels, train_features, unknown_threshold);
+          classifyAndLabelWithUnknown(show, regions, train_index, unknown_threshold);
         } else {
-          classifyAndLabel(show, regions, train_labels, train_features);
+          classifyAndLabel(show, regions, train_index);
         }
         label = "Classification";
         break;
       case 6:
-        show = colorizeRegions(labelMap, regions);
+        colorizeRegions(labelMap, regions, show);
         drawFeatures(show, regions);
-        classifyAndLabelCNN(show, regions, cnn_train_labels, cnn_train_features);
-        label = "Classification (CNN)";
+        if (cnn_search == CNN_SEARCH_PQ) {
+          classifyAndLabelCNN(show, regions, cnn_pq, &cnn_train_features);
+        } else if (cnn_search == CNN_SEARCH_EXACT) {
+          classifyAndLabelCNN(show, regions, cnn_exact);
+        } else {
+          classifyAndLabelCNN(show, regions, cnn_index);
+        }
+        label = cnn_search == CNN_SEARCH_PQ ? "Classification (CNN, PQ)"
+          : cnn_search == CNN_SEARCH_EXACT ? "Classification (CNN, exact)" : "Classification (CNN)";
         break;
       default:
         cv::cvtColor(cleaned, show, cv::COLOR_GRAY2BGR);
@@ -281,6 +305,9 @@ int main(int argc, char** argv) {
     cv::putText(show, label, cv::Point(10, 30), cv::FONT_HERSHEY_SIMPLEX, 0.7, cv::Scalar(0, 255, 0), 2);
     cv::imshow("Result", show);
 
+    // remember this frame's features, embeddings and labels per track
+    trackCache.store(regions);
+
     // handle keypresses cases
     char key = cv::waitKey(30);
     switch (key) {
@@ -309,6 +336,8 @@ int main(int argc, char** argv) {
             if (!obj_name.empty()) {
               saveTrainingExample(db_filename, obj_name, obj.featureVector);
               loadTrainingData(db_filename, train_labels, train_features);
+              train_index.build(train_labels, train_features);
+              trackCache.clearLabels(); // training data changed
             }
           }
         }
@@ -334,7 +363,7 @@ int main(int argc, char** argv) {
           if (regions.empty()) {
             std::println("No object!");
           }
-          else if (cnn_net.empty()) {
+          else if (!embedder.ready()) {
             std::println("CNN model not loaded!");
           }
           else {
@@ -348,13 +377,30 @@ int main(int argc, char** argv) {
               std::string obj_name;
               std::getline(std::cin, obj_name);
            
-              std::string pred = classifyObjectCNN(regions[0].embeddingVector,
-                cnn_train_labels, cnn_train_features, conf);
+              int pred;
+              if (cnn_search == CNN_SEARCH_PQ) {
+                pred = classifyObjectCNN(regions[0].embeddingVector, cnn_pq, conf, &cnn_train_features);
+              } else if (cnn_search == CNN_SEARCH_EXACT) {
+                pred = classifyObjectCNN(regions[0].embeddingVector, cnn_exact, conf);
+              } else {
+                pred = classifyObjectCNN(regions[0].embeddingVector, cnn_index, conf);
+              }
 
               if (!obj_name.empty()) {
                 saveTrainingExample(cnn_db_filename, obj_name, obj.embeddingVector);
                 loadTrainingData(cnn_db_filename, cnn_train_labels, cnn_train_features);
-                addResultToMatrix(cnn_conf_matrix, obj_name, pred);
+                if (!cnn_train_features.empty()) {
+                  cnn_index.add(obj_name, cnn_train_features.back()); // incremental insert, as stored in the CSV
+                  cnn_index.save(cnn_index_filename);
+                }
+                if (!cnn_pq.empty() && !cnn_train_features.empty() && cnn_pq.add(obj_name, cnn_train_features.back(), (int)cnn_train_features.size() - 1) >= 0) {
+                  // encoded with the existing codebooks, as stored in the CSV; retrained while the DB is small
+                  if (cnn_pq.stale()) cnn_pq.build(cnn_train_labels, cnn_train_features);
+                  cnn_pq.save(cnn_pq_filename);
+                }
+                if (cnn_search == CNN_SEARCH_EXACT) cnn_exact.build(cnn_train_labels, cnn_train_features);
+                trackCache.clearLabels(); // training data changed
+                addResultToMatrix(cnn_conf_matrix, classLabels().intern(obj_name), pred);
                 std::println("CNN embedding recorded. {} CNN examples total.", cnn_train_labels.size());
               }
             }
@@ -371,16 +417,15 @@ int main(int argc, char** argv) {
           }
           else {
             double conf;
-            std::string pred = classifyObject(regions[0].featureVector,
-              train_labels, train_features, conf);
+            int pred = classifyObject(regions[0].featureVector, train_index, conf);
 
-            std::println("Predicted: {}", pred);
+            std::println("Predicted: {}", classLabels().name(pred));
             std::println("Enter true label: ");
             std::string true_name;
             std::getline(std::cin, true_name);
 
             if (!true_name.empty()) {
-              addResultToMatrix(conf_matrix, true_name, pred);
+              addResultToMatrix(conf_matrix, classLabels().intern(true_name), pred);
               std::println("Recorded");
             }
           }
@@ -394,6 +439,21 @@ int main(int argc, char** argv) {
         printConfusionMatrix(cnn_conf_matrix);
         saveConfusionMatrix(cnn_conf_matrix, "confusion_matrix_cnn.csv");
         break;
+      case 'k':
+        cnn_search = (cnn_search + 1) % 3;
+        if (cnn_search == CNN_SEARCH_PQ && cnn_pq.empty()) {
+          if (!cnn_pq.loadOrBuild(cnn_pq_filename, cnn_train_labels, cnn_train_features)) {
+            std::println("Built CNN PQ index ({} embeddings, {} bytes each)", cnn_pq.size(), cnn_pq.codeSize());
+          }
+        }
+        if (cnn_search == CNN_SEARCH_EXACT) {
+          cnn_exact.build(cnn_train_labels, cnn_train_features);
+        } else {
+          cnn_exact.clear(); // free the copy
+        }
+        trackCache.clearLabels(); // re-classify with the other search
+        std::println("CNN search: {}", cnnSearchNames[cnn_search]);
+        break;
       case 'u':
         unknown_detection = !unknown_detection;
         if(unknown_detection) {
@@ -406,13 +466,12 @@ int main(int argc, char** argv) {
         // auto-learn unknown object
         if(unknown_detection && !regions.empty()) {
           double conf;
-          std::string pred = classifyWithUnknown(regions[0].featureVector,
-                                                train_labels,
-                                                train_features,
-                                                conf,
-                                                unknown_threshold);
+          int pred = classifyWithUnknown(regions[0].featureVector,
+                                        train_index,
+                                        conf,
+                                        unknown_threshold);
           
-          if(pred == "UNKNOWN") {
+          if(pred == LABEL_REJECTED) {
             std::println("Unknown object detected!");
             std::println("Enter name for this new object: ");
             std::string new_name;
@@ -421,11 +480,13 @@ int main(int argc, char** argv) {
             if(!new_name.empty()) {
               saveTrainingExample(db_filename, new_name, regions[0].featureVector);
               num_train = loadTrainingData(db_filename, train_labels, train_features);
+              train_index.build(train_labels, train_features);
+              trackCache.clearLabels(); // training data changed
               std::println("Learned new object: {}", new_name);
               std::println("Database now has {} examples", num_train);
             }
           } else {
-            std::println("Object is known: {} ({:.0f}%)", pred, conf * 100);
+            std::println("Object is known: {} ({:.0f}%)", classLabels().name(pred), conf * 100);
           }
         } else if(!unknown_detection) {
           std::println("Press 'u' to enable unknown detection");
@@ -463,6 +524,10 @@ int main(int argc, char** argv) {
         auto_mode = !auto_mode;
         std::println("Mode: {}", auto_mode ? "Auto" : "Manual");
         break;
+      case 'g':
+        local_thresh = !local_thresh;
+        std::println("Auto threshold: {}", local_thresh ? "Local (adaptive)" : "Global");
+        break;
       case '+':
         manual_thresh = std::min(manual_thresh + 5, 255);
         std::println("Threshold: {}", manual_thresh);
@@ -471,6 +536,14 @@ int main(int argc, char** argv) {
         manual_thresh = std::max(manual_thresh - 5, 0);
         std::println("Threshold: {}", manual_thresh);
         break;
+      case '[':
+        close_size = std::max(close_size - 2, 1);
+        std::println("Closing element: {}x{}", close_size, close_size);
+        break;
+      case ']':
+        close_size = std::min(close_size + 2, 31);
+        std::println("Closing element: {}x{}", close_size, close_size);
+        break;
       case 's': {
         // save the original, threshold, cleaned, and segmented images with timestamped filenames
         std::string timestamp = std::to_string(getTime());
@@ -484,7 +557,7 @@ int main(int argc, char** argv) {
         cv::imwrite(timestamp + "_features" + ".jpg", featImg);
 
         cv::Mat classImg = colorizeRegions(labelMap, regions);
-        classifyAndLabel(classImg, regions, train_labels, train_features);
+        classifyAndLabel(classImg, regions, train_index);
         cv::imwrite(timestamp + "_classified.jpg", classImg);
 
         // loop through feature vectors and print to console
@@ -0,0 +1,58 @@
+/*
+  Jenny Nguyen
+  Parker Cai
+  February 16, 2026
+  CS5330 - Project 3: Real-time 2-D Object Recognition
+
+  Horizontal stripe parallelism shared by the pixel kernels
+*/
+
+#include "or2d.h"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+
+// stripe settings, read by every kernel call
+static std::atomic<int> g_stripeGrain{ 32 };
+static std::atomic<int> g_stripeThreads{ 0 };
+
+void setStripeParallelism(int grainRows, int threads) {
+  g_stripeGrain = std::max(1, grainRows);
+  g_stripeThreads = std::max(0, threads);
+}
+
+int getStripeGrain() {
+  return g_stripeGrain;
+}
+
+int getStripeThreads() {
+  return g_stripeThreads;
+}
+
+/*
+  Split [0, rows) into at most one stripe per thread, each at least grainRows tall,
+  and run them with cv::parallel_for_. One stripe (small image or single-thread mode)
+  runs on the calling thread.
+*/
+void parallelStripes(int rows, const std::function<void(int, int)>& body, int grainRows) {
+  if (rows <= 0) {
+    return;
+  }
+  int grain = (grainRows > 0) ? grainRows : g_stripeGrain.load();
+  int threads = g_stripeThreads.load();
+  if (threads == 0) {
+    threads = std::max(1, cv::getNumThreads());
+  }
+
+  int stripes = std::min(threads, (rows + grain - 1) / grain);
+  if (stripes <= 1) {
+    body(0, rows);
+    return;
+  }
+
+  cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range& range) {
+    for (int s = range.start; s < range.end; s++) {
+      body((int)((int64_t)rows * s / stripes), (int)((int64_t)rows * (s + 1) / stripes));
+    }
+  }, stripes);
+}
@@ -0,0 +1,332 @@
+/*
+  Parker Cai
+  February 22, 2026
+  CS5330 - Project 3: Real-time 2-D Object Recognition
+
+  Product quantization (Jegou et al.) of the CNN embedding DB: per-subspace k-means
+  codebooks, one byte per subspace, asymmetric distance tables for the scan.
+*/
+
+#include "pq_index.h"
+#include "index_file.h"
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <string>
+#include <queue>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+constexpr char PQ_MAGIC[8] = { 'O', 'R', '2', 'D', 'P', 'Q', 'D', 'B' };
+constexpr uint32_t PQ_VERSION = 1;
+constexpr int PQ_MAX_CENTROIDS = 256; // codes are one byte
+
+/*
+  FNV-1a, streamed over label + embedding of each row, so add() can extend it
+*/
+static uint64_t fnv1a(uint64_t h, const void* p, size_t n) {
+  const unsigned char* b = static_cast<const unsigned char*>(p);
+  for (size_t i = 0; i < n; i++) {
+    h ^= b[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+static uint64_t hashRow(uint64_t h, const std::string& label, const std::vector<float>& embedding) {
+  h = fnv1a(h, label.data(), label.size() + 1); // include the terminator as a separator
+  return fnv1a(h, embedding.data(), embedding.size() * sizeof(float));
+}
+
+constexpr uint64_t FNV_OFFSET = 1469598103934665603ull;
+
+/*
+  Rows that build() keeps: same length as the first one
+*/
+static std::vector<int> usableRows(const std::vector<std::string>& train_labels,
+  const std::vector<std::vector<float>>& train_features) {
+  std::vector<int> rows;
+  if (train_features.empty() || train_labels.empty() || train_features[0].empty()) return rows;
+  const size_t dims = train_features[0].size();
+  for (size_t i = 0; i < train_features.size() && i < train_labels.size(); i++) {
+    if (train_features[i].size() == dims) rows.push_back((int)i);
+  }
+  return rows;
+}
+
+PqIndex::PqIndex(int numSubspaces, int rerank)
+  : numSubspaces(std::max(1, numSubspaces)), rerank(std::max(0, rerank)) {
+  clear();
+}
+
+void PqIndex::clear() {
+  numDims = 0;
+  subDims = 0;
+  numCentroids = 0;
+  codebooks.clear();
+  codes.clear();
+  labels.clear();
+  source.clear();
+  sourceHash = FNV_OFFSET;
+}
+
+void PqIndex::build(const std::vector<std::string>& train_labels,
+  const std::vector<std::vector<float>>& train_features,
+  int maxTrain) {
+  clear();
+  std::vector<int> rows = usableRows(train_labels, train_features);
+  if (rows.empty()) return;
+
+  numDims = (int)train_features[rows[0]].size();
+  subDims = (numDims + numSubspaces - 1) / numSubspaces;
+
+  // evenly spaced training sample, k-means cost grows with it
+  const int numTrain = std::min((int)rows.size(), std::max(1, maxTrain));
+  numCentroids = std::min(PQ_MAX_CENTROIDS, numTrain);
+  codebooks.assign((size_t)numSubspaces * numCentroids * subDims, 0.0f);
+
+  for (int s = 0; s < numSubspaces; s++) {
+    cv::Mat sub(numTrain, subDims, CV_32F, cv::Scalar(0));
+    for (int t = 0; t < numTrain; t++) {
+      const std::vector<float>& f = train_features[rows[(size_t)t * rows.size() / numTrain]];
+      float* dst = sub.ptr<float>(t);
+      for (int k = 0; k < subDims && s * subDims + k < numDims; k++) {
+        dst[k] = f[s * subDims + k];
+      }
+    }
+
+    cv::Mat bestLabels, centers;
+    cv::kmeans(sub, numCentroids, bestLabels,
+      cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 25, 1e-4),
+      1, cv::KMEANS_PP_CENTERS, centers);
+
+    for (int c = 0; c < numCentroids; c++) {
+      std::memcpy(&codebooks[((size_t)s * numCentroids + c) * subDims], centers.ptr<float>(c), sizeof(float) * subDims);
+    }
+  }
+
+  for (int r : rows) {
+    add(train_labels[r], train_features[r], r);
+  }
+}
+
+/*
+  Nearest centroid of every subspace slice (x is padded to numSubspaces * subDims)
+*/
+void PqIndex::encode(const float* x, uint8_t* code) const {
+  for (int s = 0; s < numSubspaces; s++) {
+    const float* xs = x + s * subDims;
+    const float* cb = &codebooks[(size_t)s * numCentroids * subDims];
+    float best = std::numeric_limits<float>::infinity();
+    int bestC = 0;
+    for (int c = 0; c < numCentroids; c++) {
+      float d = squaredL2(xs, cb + c * subDims, subDims);
+      if (d < best) {
+        best = d;
+        bestC = c;
+      }
+    }
+    code[s] = (uint8_t)bestC;
+  }
+}
+
+int PqIndex::add(const std::string& label, const std::vector<float>& embedding, int row) {
+  if (numCentroids == 0 || (int)embedding.size() != numDims) return -1;
+  if (row < 0 || (!source.empty() && row <= source.back())) return -1; // load() expects ascending rows
+
+  std::vector<float> x((size_t)numSubspaces * subDims, 0.0f);
+  std::copy(embedding.begin(), embedding.end(), x.begin());
+
+  const int id = (int)labels.size();
+  codes.resize(codes.size() + numSubspaces);
+  encode(x.data(), &codes[(size_t)id * numSubspaces]);
+  labels.push_back(classLabels().intern(label));
+  source.push_back(row);
+  sourceHash = hashRow(sourceHash, label, embedding);
+  return id;
+}
+
+bool PqIndex::stale() const {
+  return numCentroids < std::min(PQ_MAX_CENTROIDS, size());
+}
+
+/*
+  Asymmetric distance: the query stays exact, table[s][c] = |query slice s - centroid c|^2
+*/
+void PqIndex::distanceTable(const std::vector<float>& query, std::vector<float>& table) const {
+  std::vector<float> q((size_t)numSubspaces * subDims, 0.0f);
+  std::copy(query.begin(), query.end(), q.begin());
+
+  table.resize((size_t)numSubspaces * numCentroids);
+  for (int s = 0; s < numSubspaces; s++) {
+    const float* cb = &codebooks[(size_t)s * numCentroids * subDims];
+    for (int c = 0; c < numCentroids; c++) {
+      table[(size_t)s * numCentroids + c] = squaredL2(&q[(size_t)s * subDims], cb + c * subDims, subDims);
+    }
+  }
+}
+
+std::vector<std::pair<float, int>> PqIndex::search(const std::vector<float>& query, int k,
+  const std::vector<std::vector<float>>* exact) const {
+  std::vector<std::pair<float, int>> result;
+  if (labels.empty() || k < 1 || (int)query.size() != numDims) return result;
+
+  std::vector<float> table;
+  distanceTable(query, table);
+
+  // scan the codes, keep the best `keep` in a max-heap
+  const int keep = exact ? std::max(k, rerank) : k;
+  std::priority_queue<std::pair<float, int>> best;
+  const uint8_t* code = codes.data();
+  for (int i = 0; i < (int)labels.size(); i++, code += numSubspaces) {
+    const float* t = table.data();
+    float d = 0.0f;
+    for (int s = 0; s < numSubspaces; s++, t += numCentroids) {
+      d += t[code[s]];
+    }
+    if ((int)best.size() < keep) {
+      best.push({ d, i });
+    }
+    else if (d < best.top().first) {
+      best.pop();
+      best.push({ d, i });
+    }
+  }
+
+  result.resize(best.size());
+  for (int i = (int)result.size() - 1; i >= 0; i--) {
+    result[i] = best.top();
+    best.pop();
+  }
+
+  // exact re-rank of the candidates
+  if (exact) {
+    for (auto& r : result) {
+      int row = source[r.second];
+      if (row >= 0 && row < (int)exact->size() && (int)(*exact)[row].size() == numDims) {
+        r.first = squaredL2(query.data(), (*exact)[row].data(), numDims);
+      }
+    }
+    std::sort(result.begin(), result.end());
+  }
+  if ((int)result.size() > k) result.resize(k);
+  return result;
+}
+
+int PqIndex::classify(const std::vector<float>& query, float& accuracy,
+  const std::vector<std::vector<float>>* exact) const {
+  std::vector<std::pair<float, int>> r = search(query, 1, exact);
+  if (r.empty()) {
+    accuracy = 0.0f;
+    return LABEL_UNKNOWN;
+  }
+
+  accuracy = cnnConfidence(r[0].first, numDims);
+  return labels[r[0].second];
+}
+
+/*
+  File layout (native endianness):
+    magic[8] version numSubspaces numDims subDims numCentroids count sourceHash
+    codebooks[numSubspaces * numCentroids * subDims]
+    per code: labelLength label source
+    codes[count * numSubspaces]
+*/
+bool PqIndex::save(const std::string& filename) const {
+  std::ofstream out(filename, std::ios::binary);
+  if (!out.is_open()) return false;
+
+  out.write(PQ_MAGIC, sizeof(PQ_MAGIC));
+  writePod(out, PQ_VERSION);
+  writePod(out, (int32_t)numSubspaces);
+  writePod(out, (int32_t)numDims);
+  writePod(out, (int32_t)subDims);
+  writePod(out, (int32_t)numCentroids);
+  writePod(out, (int32_t)labels.size());
+  writePod(out, sourceHash);
+  out.write(reinterpret_cast<const char*>(codebooks.data()), sizeof(float) * codebooks.size());
+  for (size_t i = 0; i < labels.size(); i++) {
+    const std::string& name = classLabels().name(labels[i]); // names on disk, ids are per run
+    writePod(out, (int32_t)name.size());
+    out.write(name.data(), name.size());
+    writePod(out, (int32_t)source[i]);
+  }
+  out.write(reinterpret_cast<const char*>(codes.data()), codes.size());
+  return (bool)out;
+}
+
+bool PqIndex::load(const std::string& filename) {
+  clear();
+  std::ifstream in(filename, std::ios::binary);
+  if (!in.is_open()) return false;
+
+  char magic[sizeof(PQ_MAGIC)];
+  uint32_t version;
+  int32_t m, dims, sub, k, count;
+  uint64_t hash;
+  if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, PQ_MAGIC, sizeof(magic)) != 0) return false;
+  if (!readPod(in, version) || version != PQ_VERSION) return false;
+  if (!readPod(in, m) || !readPod(in, dims) || !readPod(in, sub) || !readPod(in, k) ||
+      !readPod(in, count) || !readPod(in, hash)) return false;
+  if (m < 1 || dims < 0 || sub < 0 || (long long)m * sub < dims || k < 0 || k > PQ_MAX_CENTROIDS || count < 0) return false;
+
+  // sizes come from the file: no more than it can hold, before allocating anything
+  const std::streamoff start = in.tellg();
+  in.seekg(0, std::ios::end);
+  const long long bytes = (long long)(in.tellg() - start);
+  in.seekg(start);
+  const long long slices = k > 0 ? (long long)m * sub : 0;
+  if (slices > bytes) return false;
+  const long long codebookBytes = slices * k * (long long)sizeof(float);
+  const long long codeBytes = (long long)count * (2 * sizeof(int32_t) + m); // len, source, code
+  if (codebookBytes + codeBytes > bytes) return false;
+
+  std::vector<float> cb((size_t)m * k * sub);
+  std::vector<std::string> names(count);
+  std::vector<int> src(count);
+  std::vector<uint8_t> cd((size_t)count * m);
+  bool ok = (bool)in.read(reinterpret_cast<char*>(cb.data()), sizeof(float) * cb.size());
+  for (int i = 0; ok && i < count; i++) {
+    int32_t len, row;
+    ok = readPod(in, len) && len >= 0 && len <= bytes;
+    if (ok) {
+      names[i].resize(len);
+      ok = (bool)in.read(names[i].data(), len) && readPod(in, row);
+      // training-data rows, ascending (build() may have skipped some, add() appends)
+      ok = ok && row >= 0 && (i == 0 || row > src[i - 1]);
+      if (ok) src[i] = row;
+    }
+  }
+  ok = ok && (bool)in.read(reinterpret_cast<char*>(cd.data()), cd.size());
+  for (size_t i = 0; ok && i < cd.size(); i++) ok = cd[i] < k;
+  if (!ok) return false;
+
+  std::vector<int> lbl(count);
+  for (int i = 0; i < count; i++) lbl[i] = classLabels().intern(names[i]); // only once the file is valid
+
+  numSubspaces = m;
+  numDims = dims;
+  subDims = sub;
+  numCentroids = k;
+  codebooks = std::move(cb);
+  labels = std::move(lbl);
+  source = std::move(src);
+  codes = std::move(cd);
+  sourceHash = hash;
+  return true;
+}
+
+bool PqIndex::loadOrBuild(const std::string& filename,
+  const std::vector<std::string>& train_labels,
+  const std::vector<std::vector<float>>& train_features) {
+  uint64_t hash = FNV_OFFSET;
+  for (int r : usableRows(train_labels, train_features)) {
+    hash = hashRow(hash, train_labels[r], train_features[r]);
+  }
+  if (load(filename) && hash == sourceHash && !stale()) return true;
+
+  build(train_labels, train_features);
+  save(filename);
+  return false;
+}
@@ -0,0 +1,125 @@
+/*
+  Parker Cai
+  February 22, 2026
+  CS5330 - Project 3: Real-time 2-D Object Recognition
+
+  Class prototypes (per-class k-means sub-centroids with bounding radii) that prune the
+  exact nearest-neighbor scans with the triangle inequality
+*/
+
+#include "or2d.h"
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+constexpr int PROTO_MIN_SPLIT = 16; // classes with fewer examples stay one cluster
+
+void ClassPrototypes::clear() {
+  numDims = 0;
+  centers.clear();
+  radius.clear();
+  start.assign(1, 0);
+  members.clear();
+  memberDist.clear();
+}
+
+void ClassPrototypes::build(const std::vector<int>& labels, const float* rows, int dims, size_t stride) {
+  std::vector<double> wide(labels.size() * dims);
+  for (size_t i = 0; i < labels.size(); i++) {
+    std::copy(rows + i * stride, rows + i * stride + dims, wide.begin() + i * dims);
+  }
+  build(labels, wide.data(), dims, dims);
+}
+
+void ClassPrototypes::build(const std::vector<int>& labels, const double* rows, int dims, size_t stride) {
+  clear();
+  if (labels.empty() || dims <= 0) return;
+  numDims = dims;
+
+  std::map<int, std::vector<int>> classes; // row ids stay ascending
+  for (int i = 0; i < (int)labels.size(); i++) {
+    classes[labels[i]].push_back(i);
+  }
+
+  for (const auto& [id, ids] : classes) {
+    const int n = (int)ids.size();
+    const int k = n < PROTO_MIN_SPLIT ? 1 : (int)std::ceil(std::sqrt((double)n));
+
+    std::vector<int> assign(n, 0);
+    if (k > 1) {
+      cv::Mat samples(n, dims, CV_32F);
+      for (int i = 0; i < n; i++) {
+        const double* r = rows + ids[i] * stride;
+        float* dst = samples.ptr<float>(i);
+        for (int d = 0; d < dims; d++) dst[d] = (float)r[d];
+      }
+      cv::Mat bestLabels, km;
+      cv::kmeans(samples, k, bestLabels,
+        cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 10, 1e-3),
+        1, cv::KMEANS_PP_CENTERS, km);
+      for (int i = 0; i < n; i++) assign[i] = bestLabels.at<int>(i);
+    }
+
+    // exact centers and radii from the assignment (any assignment keeps the bound valid)
+    for (int c = 0; c < k; c++) {
+      std::vector<double> center(dims, 0.0);
+      int size = 0;
+      for (int i = 0; i < n; i++) {
+        if (assign[i] != c) continue;
+        const double* r = rows + ids[i] * stride;
+        for (int d = 0; d < dims; d++) center[d] += r[d];
+        size++;
+      }
+      if (size == 0) continue;
+      for (int d = 0; d < dims; d++) center[d] /= size;
+
+      double maxDist = 0.0;
+      for (int i = 0; i < n; i++) {
+        if (assign[i] != c) continue;
+        const double* r = rows + ids[i] * stride;
+        double sum = 0.0;
+        for (int d = 0; d < dims; d++) {
+          double diff = r[d] - center[d];
+          sum += diff * diff;
+        }
+        members.push_back(ids[i]);
+        memberDist.push_back(std::sqrt(sum));
+        maxDist = std::max(maxDist, memberDist.back());
+      }
+      centers.insert(centers.end(), center.begin(), center.end());
+      radius.push_back(maxDist);
+      start.push_back((int)members.size());
+    }
+  }
+}
+
+/*
+  Any member x of cluster p has |q - x| >= |q - c_p| - r_p, and |q - x| >= ||q - c_p| - |x - c_p||.
+  Ranks the clusters by the first bound (nearest() applies both); false if nothing to search.
+*/
+bool ClassPrototypes::rankClusters(const std::vector<double>& query, std::vector<double>& toCenter,
+  std::vector<double>& bound, std::vector<int>& order) const {
+  if (radius.empty() || (int)query.size() != numDims) return false;
+
+  const int numClusters = (int)radius.size();
+  toCenter.resize(numClusters);
+  bound.resize(numClusters);
+  for (int p = 0; p < numClusters; p++) {
+    const double* c = &centers[(size_t)p * numDims];
+    double sum = 0.0;
+    for (int d = 0; d < numDims; d++) {
+      double diff = query[d] - c[d];
+      sum += diff * diff;
+    }
+    toCenter[p] = std::sqrt(sum);
+    bound[p] = toCenter[p] - radius[p];
+  }
+
+  order.resize(numClusters);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](int a, int b) { return bound[a] < bound[b]; });
+  return true;
+}
@@ -11,7 +11,6 @@
 #include <vector>
 #include <algorithm>
 #include <cmath>
-#include <unordered_map>
 
 
 // Simple hard-coded pastel color palette for region visualization (BGR format)
@@ -34,91 +33,285 @@ static cv::Vec3b colorForLabel(int label) {
 /*
   Build a color-coded region image without any overlays (no bbox, no centroid).
   Used as a clean base for the features display mode to draw features on top of the colored regions.
+
+  Colors come from a flat table indexed by label (0 and labels that were not kept are black),
+  and only the rows/columns inside the kept regions' bounding boxes are visited. Each row is
+  a straight gather through the table, run over parallel horizontal stripes.
+  Renders into out, which is reused when it already has the right size and type.
 */
-cv::Mat colorizeRegions(const cv::Mat& labelMap, const std::vector<RegionInfo>& regions) {
-  // Assign color to the region pixels (single pass)
-  // build a label:color map for faster color lookup
-  std::unordered_map<int, cv::Vec3b> labelColor;
+void colorizeRegions(const cv::Mat& labelMap, const std::vector<RegionInfo>& regions, cv::Mat& out) {
+  out.create(labelMap.size(), CV_8UC3); // Color-coded display image
+  out.setTo(cv::Scalar(0, 0, 0));
+  if (labelMap.empty() || regions.empty()) {
+    return;
+  }
+
+  // label -> color table, black for everything else
+  int maxLabel = 0;
   for (const auto& region : regions) {
-    labelColor[region.label] = region.color;
-  }
-  cv::Mat result = cv::Mat::zeros(labelMap.size(), CV_8UC3); // Color-coded display image
-  // Iterate through the label image and assign colors
-  for (int r = 0; r < labelMap.rows; r++) {
-    for (int c = 0; c < labelMap.cols; c++) {
-      int label = labelMap.at<int>(r, c);
-      auto it = labelColor.find(label);
-      if (it != labelColor.end()) {
-        result.at<cv::Vec3b>(r, c) = it->second; // assign color based on label color map
-      }
+    maxLabel = std::max(maxLabel, region.label);
+  }
+  std::vector<cv::Vec3b> lut(maxLabel + 1, cv::Vec3b(0, 0, 0));
+  for (const auto& region : regions) {
+    if (region.label > 0) {
+      lut[region.label] = region.color;
     }
   }
+
+  // only the kept bboxes need painting (no bbox: whole frame)
+  const cv::Rect frame(0, 0, labelMap.cols, labelMap.rows);
+  std::vector<cv::Rect> boxes;
+  int yBegin = labelMap.rows, yEnd = 0;
+  for (const auto& region : regions) {
+    cv::Rect box = (region.bbox.area() > 0) ? (region.bbox & frame) : frame;
+    if (box.area() == 0) continue;
+    boxes.push_back(box);
+    yBegin = std::min(yBegin, box.y);
+    yEnd = std::max(yEnd, box.y + box.height);
+  }
+  if (yBegin >= yEnd) {
+    return;
+  }
+
+  const unsigned lutMax = (unsigned)maxLabel;
+  parallelStripes(yEnd - yBegin, [&](int rowBegin, int rowEnd) {
+    for (int r = yBegin + rowBegin; r < yBegin + rowEnd; r++) {
+      const int* labels = labelMap.ptr<int>(r);
+      cv::Vec3b* dst = out.ptr<cv::Vec3b>(r);
+      for (const cv::Rect& box : boxes) {
+        if (r < box.y || r >= box.y + box.height) continue;
+        for (int c = box.x; c < box.x + box.width; c++) {
+          unsigned label = (unsigned)labels[c];
+          dst[c] = lut[(label <= lutMax) ? label : 0]; // assign color based on label color table
+        }
+      }
+    }
+  });
+}
+
+cv::Mat colorizeRegions(const cv::Mat& labelMap, const std::vector<RegionInfo>& regions) {
+  cv::Mat result;
+  colorizeRegions(labelMap, regions, result);
   return result;
 }
 
 
+/*
+  Run-length connected components (4-connectivity)
+
+  Steps:
+    1. Each row is cut into runs of foreground pixels
+    2. A run is merged (union-find) with every run of the row above that shares a column.
+       The root of a component is its first run in raster order, so labels come out in
+       the same raster order as connectedComponentsWithStats
+    3. Every run adds its area, bbox and raw moments (up to third order) to its root.
+       Over a run x = x0 .. x1-1 on row y the power sums of x are closed form, so a run
+       costs the same whatever its length
+    4. Small regions and regions touching the border are dropped right here
+
+  Output: candidates (label, area, bbox, centroid, moments), runs and the label of every run
+*/
+
+// sum of x^k for x in [0, n), k = 1..3
+static inline int64_t powerSum1(int64_t n) { return n * (n - 1) / 2; }
+static inline int64_t powerSum2(int64_t n) { return (n - 1) * n * (2 * n - 1) / 6; }
+static inline int64_t powerSum3(int64_t n) { return powerSum1(n) * powerSum1(n); }
+
+static int findRoot(std::vector<int>& parent, int i) {
+  while (parent[i] != i) {
+    parent[i] = parent[parent[i]]; // path halving
+    i = parent[i];
+  }
+  return i;
+}
+
+static void labelRuns(const cv::Mat& binary, int minSize,
+  std::vector<RegionInfo>& candidates, std::vector<cv::Vec3i>& runs, std::vector<int>& runLabel) {
+  CV_Assert(binary.type() == CV_8UC1);
+  const int rows = binary.rows;
+  const int cols = binary.cols;
+
+  // 1 + 2. runs of each row, merged with the overlapping runs of the row above
+  runs.clear();
+  std::vector<int> parent;
+  int prevBegin = 0, prevEnd = 0;
+  for (int y = 0; y < rows; y++) {
+    const uchar* row = binary.ptr<uchar>(y);
+    int curBegin = (int)runs.size();
+    for (int x = 0; x < cols; ) {
+      if (row[x] == 0) {
+        x++;
+        continue;
+      }
+      int x0 = x;
+      while (x < cols && row[x] != 0) x++;
+      runs.push_back(cv::Vec3i(y, x0, x));
+      parent.push_back((int)parent.size());
+    }
+    int curEnd = (int)runs.size();
+
+    int p = prevBegin;
+    for (int i = curBegin; i < curEnd; i++) {
+      // skip runs of the row above that end before this one starts
+      while (p < prevEnd && runs[p][2] <= runs[i][1]) p++;
+      for (int q = p; q < prevEnd && runs[q][1] < runs[i][2]; q++) {
+        int a = findRoot(parent, q);
+        int b = findRoot(parent, i);
+        if (a != b) {
+          parent[std::max(a, b)] = std::min(a, b); // keep the raster-first run as root
+        }
+      }
+    }
+    prevBegin = curBegin;
+    prevEnd = curEnd;
+  }
+
+  // 3. accumulate per root; roots get labels 1, 2, ... in raster order
+  struct Accum {
+    double m[10] = { 0 }; // m00 m10 m01 m20 m11 m02 m30 m21 m12 m03
+    int left, top, right, bottom;
+    bool touchesBorder = false;
+  };
+  const int numRuns = (int)runs.size();
+  std::vector<int> rootLabel(numRuns, 0);
+  std::vector<Accum> accum(1); // index 0 = background, unused
+  runLabel.assign(numRuns, 0);
+  for (int i = 0; i < numRuns; i++) {
+    int root = findRoot(parent, i);
+    if (root == i) {
+      rootLabel[i] = (int)accum.size();
+      Accum a;
+      a.left = runs[i][1];
+      a.top = runs[i][0];
+      a.right = runs[i][2] - 1;
+      a.bottom = runs[i][0];
+      accum.push_back(a);
+    }
+    int label = rootLabel[root];
+    runLabel[i] = label;
+
+    Accum& a = accum[label];
+    const int y = runs[i][0], x0 = runs[i][1], x1 = runs[i][2];
+    const double s0 = x1 - x0;
+    const double s1 = (double)(powerSum1(x1) - powerSum1(x0));
+    const double s2 = (double)(powerSum2(x1) - powerSum2(x0));
+    const double s3 = (double)(powerSum3(x1) - powerSum3(x0));
+    const double y1 = y, y2 = y1 * y1, y3 = y2 * y1;
+    a.m[0] += s0;
+    a.m[1] += s1;
+    a.m[2] += y1 * s0;
+    a.m[3] += s2;
+    a.m[4] += y1 * s1;
+    a.m[5] += y2 * s0;
+    a.m[6] += s3;
+    a.m[7] += y1 * s2;
+    a.m[8] += y2 * s1;
+    a.m[9] += y3 * s0;
+    a.left = std::min(a.left, x0);
+    a.right = std::max(a.right, x1 - 1);
+    a.bottom = y; // runs arrive in row order
+    if (x0 == 0 || x1 == cols || y == 0 || y == rows - 1) {
+      a.touchesBorder = true;
+    }
+  }
+
+  // 4. size and border filters
+  candidates.clear();
+  for (int label = 1; label < (int)accum.size(); label++) {
+    const Accum& a = accum[label];
+    if (a.m[0] < minSize || a.touchesBorder) {
+      continue;
+    }
+    RegionInfo candidate;
+    candidate.label = label;
+    candidate.area = (int)a.m[0];
+    candidate.bbox = cv::Rect(a.left, a.top, a.right - a.left + 1, a.bottom - a.top + 1);
+    candidate.moments = cv::Moments(a.m[0], a.m[1], a.m[2], a.m[3], a.m[4],
+      a.m[5], a.m[6], a.m[7], a.m[8], a.m[9]);
+    candidate.centroid = cv::Point2f((float)(a.m[1] / a.m[0]), (float)(a.m[2] / a.m[0]));
+    candidate.color = { 0, 0, 0 };  // init to black, will assign color later
+    candidates.push_back(candidate);
+  }
+}
+
+
 /*
   Segment binary image into regions using connected components analysis.
 
   Steps:
-    1. Run OpenCV's connectedComponentsWithStats to get labels, stats, and centroids
+    1. Label the image: run-length union-find (default) or OpenCV's
+       connectedComponentsWithStats to get labels, stats, and centroids
     2. Filter out small regions and the ones touching the borders
     3. Sort remaining regions by area and keep only top maxRegions (3 largest)
-    4. Assign colors based on label and create a color-coded result image
+    4. Assign track IDs (RegionTracker) and colors, and create a color-coded result image
     5. Draw bounding boxes and centroids on the result image
+
+  With the run-length labeling only the kept regions are painted into labelMap,
+  and each region carries its runs and moments for computeRegionFeatures().
 */
-cv::Mat segmentRegions(
+static cv::Mat segmentRegionsImpl(
   const cv::Mat& binary,
   std::vector<RegionInfo>& regions,
   cv::Mat& labelMap,
+  RegionTracker* tracker,
   int minSize,
-  int maxRegions) {
+  int maxRegions,
+  int cclMethod) {
   // Clear output regions vector
   regions.clear();
 
-  // Run OpenCV's connected components with stats
-  cv::Mat stats, centroids;
-  int numLabels = cv::connectedComponentsWithStats(binary, labelMap, stats, centroids, 4, CV_32S, cv::CCL_DEFAULT);
-  // CCL_DEFAULT (Spaghetti4C) — Bolelli et al. 2021. Two-pass union-find for merging labels + DAG-based decision trees 
-  // CCL_WU (SAUF) — Wu et al. 2009. Classic two-pass with array-based union-find. 
-
   // Build candidate region list
   std::vector<RegionInfo> candidates;
-  // (skip label 0 = background)
-  for (int i = 1; i < numLabels; i++) {
-    int area = stats.at<int>(i, cv::CC_STAT_AREA);
+  std::vector<cv::Vec3i> runs;
+  std::vector<int> runLabel;
 
-    // Ignore regions smaller than minSize (default 20x20 pixels = 400 px area)
-    if (area < minSize) {
-      continue;
-    }
+  if (cclMethod == CCL_METHOD_RLE) {
+    // size and border filters are applied while labeling
+    labelRuns(binary, minSize, candidates, runs, runLabel);
+  }
+  else {
+    // Run OpenCV's connected components with stats
+    cv::Mat stats, centroids;
+    int numLabels = cv::connectedComponentsWithStats(binary, labelMap, stats, centroids, 4, CV_32S, cv::CCL_DEFAULT);
+    // CCL_DEFAULT (Spaghetti4C) — Bolelli et al. 2021. Two-pass union-find for merging labels + DAG-based decision trees 
+    // CCL_WU (SAUF) — Wu et al. 2009. Classic two-pass with array-based union-find. 
 
-    int left = stats.at<int>(i, cv::CC_STAT_LEFT);
-    int top = stats.at<int>(i, cv::CC_STAT_TOP);
-    int width = stats.at<int>(i, cv::CC_STAT_WIDTH);
-    int height = stats.at<int>(i, cv::CC_STAT_HEIGHT);
+    // (skip label 0 = background)
+    for (int i = 1; i < numLabels; i++) {
+      int area = stats.at<int>(i, cv::CC_STAT_AREA);
 
-    // Skip regions touching the image border
-    if (left == 0 || top == 0 ||
-      left + width >= binary.cols ||
-      top + height >= binary.rows) {
-      continue;
-    }
+      // Ignore regions smaller than minSize (default 20x20 pixels = 400 px area)
+      if (area < minSize) {
+        continue;
+      }
 
-    // Get centroid
-    cv::Point2f centroid;
-    centroid.x = centroids.at<double>(i, 0);
-    centroid.y = centroids.at<double>(i, 1);
+      int left = stats.at<int>(i, cv::CC_STAT_LEFT);
+      int top = stats.at<int>(i, cv::CC_STAT_TOP);
+      int width = stats.at<int>(i, cv::CC_STAT_WIDTH);
+      int height = stats.at<int>(i, cv::CC_STAT_HEIGHT);
 
-    // Add candidate region info to the list
-    RegionInfo candidate;
-    candidate.label = i;
-    candidate.centroid = centroid;
-    candidate.bbox = cv::Rect(left, top, width, height);
-    candidate.area = area;
-    candidate.color = { 0, 0, 0 };  // init to black, will assign color later
+      // Skip regions touching the image border
+      if (left == 0 || top == 0 ||
+        left + width >= binary.cols ||
+        top + height >= binary.rows) {
+        continue;
+      }
 
-    candidates.push_back(candidate);
+      // Get centroid
+      cv::Point2f centroid;
+      centroid.x = centroids.at<double>(i, 0);
+      centroid.y = centroids.at<double>(i, 1);
+
+      // Add candidate region info to the list
+      RegionInfo candidate;
+      candidate.label = i;
+      candidate.centroid = centroid;
+      candidate.bbox = cv::Rect(left, top, width, height);
+      candidate.area = area;
+      candidate.color = { 0, 0, 0 };  // init to black, will assign color later
+
+      candidates.push_back(candidate);
+    }
   }
 
   // Sort candidates by area in descending order
@@ -133,45 +326,32 @@ cv::Mat segmentRegions(
     candidates.resize(maxRegions);
   }
 
-  // Assign colors with centroid matching against previous frame regions
-  // use static variables to persist between calls
-  static std::vector<RegionInfo> prevRegions;
-  static int nextColorIdx = 0;
-  // max allowed centroid match distance squared: dx^2 + dy^2 < 50^2 pixels
-  float maxMatchDist = 50.0f;
-  std::vector<uchar> prevUsed(prevRegions.size(), 0); // to track which previous regions have been matched
-
-  for (RegionInfo& candidate : candidates) {
-    int bestIdx = -1;
-    float bestDistSq = maxMatchDist * maxMatchDist;
-
-    for (int i = 0; i < static_cast<int>(prevRegions.size()); i++) {
-      // Skip already matched previous regions
-      if (prevUsed[i]) {
-        continue;
-      }
-      // Compute squared distance between centroids
-      const float dx = candidate.centroid.x - prevRegions[i].centroid.x;
-      const float dy = candidate.centroid.y - prevRegions[i].centroid.y;
-      const float distSq = dx * dx + dy * dy;
-      // Check if this previous region is a better match
-      if (distSq < bestDistSq) {
-        bestDistSq = distSq;
-        bestIdx = i;
+  // Run-length labeling: hand the runs to the kept regions and paint only those into the label map
+  if (cclMethod == CCL_METHOD_RLE) {
+    labelMap.create(binary.size(), CV_32S);
+    labelMap.setTo(cv::Scalar(0));
+    for (size_t i = 0; i < runs.size(); i++) {
+      for (RegionInfo& candidate : candidates) {
+        if (candidate.label != runLabel[i]) continue;
+        const cv::Vec3i& run = runs[i];
+        candidate.runs.push_back(run);
+        int* dst = labelMap.ptr<int>(run[0]);
+        std::fill(dst + run[1], dst + run[2], candidate.label);
+        break;
       }
     }
-    // Assign color 
-    if (bestIdx != -1) { // found a match, reuse color
-      candidate.color = prevRegions[bestIdx].color;
-      prevUsed[bestIdx] = 1; // mark this previous region as matched
-    }
-    else { // no match, assign new color based on label
-      candidate.color = colorForLabel(nextColorIdx++);
-    }
+  }
 
+  // Track IDs from the tracker (when given); the color follows the track so it does not
+  // flicker between frames, otherwise it follows the area rank
+  if (tracker) {
+    tracker->update(candidates);
+  }
+  for (size_t i = 0; i < candidates.size(); i++) {
+    RegionInfo& candidate = candidates[i];
+    candidate.color = colorForLabel(tracker ? candidate.trackId : (int)i);
     regions.push_back(candidate);
   }
-  prevRegions = regions;
 
   // Build color-coded region image, then draw AABB + centroids on top
   cv::Mat result = colorizeRegions(labelMap, regions);
@@ -188,3 +368,13 @@ cv::Mat segmentRegions(
 
   return result;
 }
+
+cv::Mat segmentRegions(const cv::Mat& binary, std::vector<RegionInfo>& regions, cv::Mat& labelMap,
+  int minSize, int maxRegions, int cclMethod) {
+  return segmentRegionsImpl(binary, regions, labelMap, nullptr, minSize, maxRegions, cclMethod);
+}
+
+cv::Mat segmentRegions(const cv::Mat& binary, std::vector<RegionInfo>& regions, cv::Mat& labelMap,
+  RegionTracker& tracker, int minSize, int maxRegions, int cclMethod) {
+  return segmentRegionsImpl(binary, regions, labelMap, &tracker, minSize, maxRegions, cclMethod);
+}
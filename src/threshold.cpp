@@ -10,21 +10,284 @@
 #include "or2d.h"
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <cstring>
+#include <mutex>
+
+// SIMD paths for the row kernels (scalar fallback otherwise)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OR2D_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OR2D_SSE2 1
+#endif
 
 using namespace cv;
 using namespace std;
 
 /*
-  Threshold the input image to separate objects from background
+  ISODATA threshold on a 256-bin histogram (1-D k-means with k=2)
 
-  If threshValue is -1, calculates threshold automatically
-  otherwise uses the value you give it
+  Same clustering the k-means path does, but solved on the histogram:
+  prefix sums give the count and mean of each cluster for any split in O(1),
+  so each iteration is constant time and the whole solve is O(256).
+  Iterates t = midpoint(mean below t, mean above t) until t stops moving.
+  A warm start (last frame's threshold) usually converges in 1-2 iterations.
+*/
+int histogramThreshold(const int hist[256], int warmStart) {
+  // prefix count and intensity sum: bins [0, t)
+  long long cnt[257], sum[257];
+  cnt[0] = 0;
+  sum[0] = 0;
+  for (int i = 0; i < 256; i++) {
+    cnt[i + 1] = cnt[i] + hist[i];
+    sum[i + 1] = sum[i] + (long long)i * hist[i];
+  }
 
-  Input: grayscale or color image
-  Output: binary image (white objects, black background)
+  long long total = cnt[256];
+  if (total == 0) {
+    return 128;
+  }
+
+  // start from the global mean unless a usable warm start is given
+  int t = (int)ceil((double)sum[256] / total);
+  if (warmStart > 0 && warmStart < 256 && cnt[warmStart] > 0 && cnt[warmStart] < total) {
+    t = warmStart;
+  }
+
+  for (int iter = 0; iter < 256; iter++) {
+    long long nLow = cnt[t];
+    long long nHigh = total - nLow;
+    // only one gray level present (or no split possible)
+    if (nLow == 0 || nHigh == 0) {
+      break;
+    }
+
+    double meanLow = (double)sum[t] / nLow;
+    double meanHigh = (double)(sum[256] - sum[t]) / nHigh;
+
+    // pixels below the midpoint join the dark cluster: v < m  <=>  v < ceil(m)
+    int next = (int)ceil((meanLow + meanHigh) / 2.0);
+    if (next == t) {
+      break;
+    }
+    t = next;
+  }
+
+  return t;
+}
+
+/*
+  Reflect-101 border index (OpenCV's BORDER_DEFAULT): -1 -> 1, n -> n-2
+  Only ever called with i in [-2, n+1] and n >= 3
+*/
+static inline int reflect101(int i, int n) {
+  if (i < 0) return -i;
+  if (i >= n) return 2 * n - 2 - i;
+  return i;
+}
+
+/*
+  Convert one row to luma and pad it by 2 px on each side (reflect-101)
+  Same fixed-point weights as cvtColor(BGR2GRAY): 0.114 B + 0.587 G + 0.299 R in Q14
+*/
+static void lumaRowPadded(const uchar* src, int channels, int cols, uchar* padded) {
+  uchar* luma = padded + 2;
+  if (channels == 3) {
+    for (int c = 0; c < cols; c++) {
+      const uchar* p = src + 3 * c;
+      luma[c] = (uchar)((p[0] * 1868 + p[1] * 9617 + p[2] * 4899 + (1 << 13)) >> 14);
+    }
+  }
+  else {
+    memcpy(luma, src, cols);
+  }
+  padded[0] = luma[2];
+  padded[1] = luma[1];
+  luma[cols] = luma[cols - 2];
+  luma[cols + 1] = luma[cols - 3];
+}
+
+/*
+  Horizontal pass of the 5x5 Gaussian: [1 4 6 4 1] (sum <= 16*255, fits in 16 bits)
+*/
+static void hBlurRow(const uchar* padded, ushort* dst, int cols) {
+  for (int c = 0; c < cols; c++) {
+    const uchar* p = padded + c;
+    dst[c] = (ushort)(p[0] + p[4] + 4 * (p[1] + p[3]) + 6 * p[2]);
+  }
+}
+
+/*
+  Vertical pass of the 5x5 Gaussian on five horizontally blurred rows,
+  rounded back to 8 bits: (sum + 128) >> 8. Max sum is 256*255, so 16-bit lanes never overflow.
+*/
+static void vBlurRow(const ushort* const rows[5], uchar* dst, int cols) {
+  const ushort* r0 = rows[0];
+  const ushort* r1 = rows[1];
+  const ushort* r2 = rows[2];
+  const ushort* r3 = rows[3];
+  const ushort* r4 = rows[4];
+  int c = 0;
+
+#ifdef OR2D_AVX2
+  const __m256i round256 = _mm256_set1_epi16(128);
+  for (; c + 32 <= cols; c += 32) {
+    __m256i out[2];
+    for (int h = 0; h < 2; h++) {
+      int o = c + 16 * h;
+      __m256i a = _mm256_loadu_si256((const __m256i*)(r0 + o));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(r1 + o));
+      __m256i m = _mm256_loadu_si256((const __m256i*)(r2 + o));
+      __m256i d = _mm256_loadu_si256((const __m256i*)(r3 + o));
+      __m256i e = _mm256_loadu_si256((const __m256i*)(r4 + o));
+      __m256i s = _mm256_add_epi16(_mm256_add_epi16(a, e), _mm256_slli_epi16(_mm256_add_epi16(b, d), 2));
+      s = _mm256_add_epi16(s, _mm256_add_epi16(_mm256_slli_epi16(m, 2), _mm256_slli_epi16(m, 1)));
+      out[h] = _mm256_srli_epi16(_mm256_add_epi16(s, round256), 8);
+    }
+    // packus interleaves the 128-bit lanes, put them back in order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(out[0], out[1]), 0xD8);
+    _mm256_storeu_si256((__m256i*)(dst + c), packed);
+  }
+#endif
+#ifdef OR2D_SSE2
+  const __m128i round128 = _mm_set1_epi16(128);
+  for (; c + 16 <= cols; c += 16) {
+    __m128i out[2];
+    for (int h = 0; h < 2; h++) {
+      int o = c + 8 * h;
+      __m128i a = _mm_loadu_si128((const __m128i*)(r0 + o));
+      __m128i b = _mm_loadu_si128((const __m128i*)(r1 + o));
+      __m128i m = _mm_loadu_si128((const __m128i*)(r2 + o));
+      __m128i d = _mm_loadu_si128((const __m128i*)(r3 + o));
+      __m128i e = _mm_loadu_si128((const __m128i*)(r4 + o));
+      __m128i s = _mm_add_epi16(_mm_add_epi16(a, e), _mm_slli_epi16(_mm_add_epi16(b, d), 2));
+      s = _mm_add_epi16(s, _mm_add_epi16(_mm_slli_epi16(m, 2), _mm_slli_epi16(m, 1)));
+      out[h] = _mm_srli_epi16(_mm_add_epi16(s, round128), 8);
+    }
+    _mm_storeu_si128((__m128i*)(dst + c), _mm_packus_epi16(out[0], out[1]));
+  }
+#endif
+  for (; c < cols; c++) {
+    int s = r0[c] + r4[c] + 4 * (r1[c] + r3[c]) + 6 * r2[c];
+    dst[c] = (uchar)((s + 128) >> 8);
+  }
+}
+
+/*
+  Binary compare for one row: dst = (src < t) ? 255 : 0
+  v < t is the same as min(v, t-1) == v, which works on unsigned bytes.
+*/
+static void thresholdRow(const uchar* src, uchar* dst, int cols, int t) {
+  if (t <= 0) {
+    memset(dst, 0, cols);
+    return;
+  }
+  if (t > 255) {
+    memset(dst, 255, cols);
+    return;
+  }
+  int c = 0;
+#ifdef OR2D_AVX2
+  const __m256i tm1_256 = _mm256_set1_epi8((char)(t - 1));
+  for (; c + 32 <= cols; c += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(src + c));
+    __m256i lt = _mm256_cmpeq_epi8(_mm256_min_epu8(v, tm1_256), v);
+    _mm256_storeu_si256((__m256i*)(dst + c), lt);
+  }
+#endif
+#ifdef OR2D_SSE2
+  const __m128i tm1_128 = _mm_set1_epi8((char)(t - 1));
+  for (; c + 16 <= cols; c += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(src + c));
+    __m128i lt = _mm_cmpeq_epi8(_mm_min_epu8(v, tm1_128), v);
+    _mm_storeu_si128((__m128i*)(dst + c), lt);
+  }
+#endif
+  for (; c < cols; c++) {
+    dst[c] = (src[c] < t) ? 255 : 0;
+  }
+}
+
+/*
+  Fused grayscale + 5x5 Gaussian blur, streamed one row at a time.
+
+  Keeps a ring of 5 horizontally blurred rows (indexed by source row % 5), so each
+  source row is converted and blurred exactly once and no frame-sized gray or blur
+  buffer is needed. Calls rowFn(r, blurredRow) for every output row in [rowBegin, rowEnd).
+  The 2 rows above and below the range are read as a halo, so stripes can run in parallel.
+  Results match cvtColor(BGR2GRAY) + GaussianBlur(5x5, BORDER_DEFAULT) fixed-point output.
+  Needs an 8-bit, 1 or 3 channel image of at least 3x3.
+*/
+template <class RowFn>
+static void streamBlurredLuma(const Mat& input, int rowBegin, int rowEnd, RowFn&& rowFn) {
+  const int rows = input.rows;
+  const int cols = input.cols;
+  const int channels = input.channels();
+
+  vector<uchar> padded(cols + 4);
+  vector<ushort> ringData(5 * cols);
+  vector<uchar> blurred(cols);
+  int ringRow[5] = { -1, -1, -1, -1, -1 }; // which source row each slot holds
+
+  for (int r = rowBegin; r < rowEnd; r++) {
+    const ushort* window[5];
+    for (int k = 0; k < 5; k++) {
+      int src = reflect101(r + k - 2, rows);
+      int slot = src % 5;
+      ushort* slotRow = &ringData[slot * cols];
+      if (ringRow[slot] != src) {
+        lumaRowPadded(input.ptr<uchar>(src), channels, cols, padded.data());
+        hBlurRow(padded.data(), slotRow, cols);
+        ringRow[slot] = src;
+      }
+      window[k] = slotRow;
+    }
+    vBlurRow(window, blurred.data(), cols);
+    rowFn(r, blurred.data());
+  }
+}
+
+/*
+  The fused kernel handles 8-bit gray/BGR images of at least 3x3
+*/
+static bool canFuse(const Mat& input) {
+  return input.depth() == CV_8U &&
+    (input.channels() == 1 || input.channels() == 3) &&
+    input.rows >= 3 && input.cols >= 3;
+}
+
+/*
+  Full blurred grayscale image, optionally with its 256-bin histogram built in the same sweep
+  (hist may be null). Falls back to cvtColor + GaussianBlur for inputs the fused kernel skips.
 */
-Mat thresholdImage(const Mat& input, int threshValue) {
-  Mat gray, binary;
+static void blurredGray(const Mat& input, Mat& gray, int* hist) {
+  const int cols = input.cols;
+
+  if (canFuse(input)) {
+    gray.create(input.size(), CV_8U);
+    // each stripe keeps its own ring and histogram, merged at the end
+    std::mutex histLock;
+    parallelStripes(input.rows, [&](int rowBegin, int rowEnd) {
+      int local[256] = { 0 };
+      streamBlurredLuma(input, rowBegin, rowEnd, [&](int r, const uchar* blurred) {
+        memcpy(gray.ptr<uchar>(r), blurred, cols);
+        if (hist) {
+          for (int c = 0; c < cols; c++) {
+            local[blurred[c]]++;
+          }
+        }
+      });
+      if (hist) {
+        std::lock_guard<std::mutex> guard(histLock);
+        for (int i = 0; i < 256; i++) {
+          hist[i] += local[i];
+        }
+      }
+    });
+    return;
+  }
 
   // convert to grayscale if needed
   if (input.channels() == 3) {
@@ -37,51 +300,245 @@ Mat thresholdImage(const Mat& input, int threshValue) {
   // reduce noise
   GaussianBlur(gray, gray, Size(5, 5), 0);
 
-  // auto threshold if not given
-  if (threshValue < 0) {
-    vector<float> pixels;
-
-    // use average pixel value
-    for (int r = 0; r < gray.rows; r += 4) {
-      for (int c = 0; c < gray.cols; c += 4) {
-        pixels.push_back((float)gray.at<uchar>(r, c));
+  if (hist) {
+    for (int r = 0; r < gray.rows; r++) {
+      const uchar* row = gray.ptr<uchar>(r);
+      for (int c = 0; c < gray.cols; c++) {
+        hist[row[c]]++;
       }
     }
+  }
+}
 
-    // run k-means to find object and background clusters
-    if (pixels.size() > 0) {
-      // convert vector to Mat for k-means
-      Mat pixelMat(pixels.size(), 1, CV_32F);
-      for (size_t i = 0; i < pixels.size(); i++) {
-        pixelMat.at<float>(i) = pixels[i];
-      }
+/*
+  Original auto threshold: k-means (k=2) on every 4th pixel in each direction
+*/
+static int kmeansThreshold(const Mat& gray) {
+  vector<float> pixels;
+  pixels.reserve(((gray.rows + 3) / 4) * ((gray.cols + 3) / 4));
+
+  // use average pixel value
+  for (int r = 0; r < gray.rows; r += 4) {
+    for (int c = 0; c < gray.cols; c += 4) {
+      pixels.push_back((float)gray.at<uchar>(r, c));
+    }
+  }
+
+  if (pixels.empty()) {
+    return 128;
+  }
+
+  // run k-means to find object and background clusters
+  Mat pixelMat(pixels.size(), 1, CV_32F, pixels.data());
+  Mat labels, centers;
+  kmeans(pixelMat, 2, labels,
+    TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 10, 1.0),
+    3, KMEANS_PP_CENTERS, centers);
+  return (centers.at<float>(0) + centers.at<float>(1)) / 2;
+}
+
+/*
+  Threshold the input image to separate objects from background
+
+  If threshValue is -1, calculates threshold automatically
+  otherwise uses the value you give it
+
+  Auto methods:
+    AUTO_THRESH_HISTOGRAM - one pass to build a 256-bin histogram, then ISODATA
+                            on the histogram (optionally warm-started from lastThresh)
+    AUTO_THRESH_KMEANS    - original k-means on every 4th pixel in each direction
+
+    AUTO_THRESH_LOCAL     - per-tile thresholds, see localThresholdImage()
+
+  Grayscale conversion, blur and the binary compare are fused into one row-streaming
+  sweep (see streamBlurredLuma). With a fixed threshold that is the only pass over the
+  image; auto modes keep the blurred image for the compare once the threshold is known.
+  Every pass runs over parallel horizontal stripes (see parallelStripes).
+
+  Input: grayscale or color image
+  Output: binary image (white objects, black background)
+*/
+Mat thresholdImage(const Mat& input, int threshValue, int method, int* lastThresh) {
+  // local thresholds are per pixel, there is no single value to report
+  if (threshValue < 0 && method == AUTO_THRESH_LOCAL) {
+    return localThresholdImage(input);
+  }
+
+  Mat binary(input.size(), CV_8U);
+  const int cols = input.cols;
 
-      // k-means with k=2 
-      Mat labels, centers;
-      kmeans(pixelMat, 2, labels,
-        TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 10, 1.0),
-        3, KMEANS_PP_CENTERS, centers);
-      threshValue = (centers.at<float>(0) + centers.at<float>(1)) / 2;
+  // known threshold: one sweep, blurred rows never leave the row buffer
+  if (threshValue >= 0 && canFuse(input)) {
+    parallelStripes(input.rows, [&](int rowBegin, int rowEnd) {
+      streamBlurredLuma(input, rowBegin, rowEnd, [&](int r, const uchar* blurred) {
+        thresholdRow(blurred, binary.ptr<uchar>(r), cols, threshValue);
+      });
+    });
+    if (lastThresh) {
+      *lastThresh = threshValue;
     }
-    else {
-      threshValue = 128;
+    return binary;
+  }
+
+  // otherwise keep the blurred image around until the threshold is known
+  Mat gray;
+  int hist[256] = { 0 };
+  bool useHist = threshValue < 0 && method == AUTO_THRESH_HISTOGRAM;
+  blurredGray(input, gray, useHist ? hist : nullptr);
+
+  // auto threshold if not given
+  if (useHist) {
+    int warmStart = lastThresh ? *lastThresh : -1;
+    threshValue = histogramThreshold(hist, warmStart);
+  }
+  else if (threshValue < 0) {
+    threshValue = kmeansThreshold(gray);
+  }
+
+  if (lastThresh) {
+    *lastThresh = threshValue;
+  }
+
+  // binary compare, row by row
+  parallelStripes(gray.rows, [&](int rowBegin, int rowEnd) {
+    for (int r = rowBegin; r < rowEnd; r++) {
+      thresholdRow(gray.ptr<uchar>(r), binary.ptr<uchar>(r), cols, threshValue);
     }
+  });
+
+  return binary;
+}
+
+
+/*
+  Local (adaptive) threshold for uneven lighting
+
+  Steps:
+    1. Blurred grayscale image and its integral images (sum and sum of squares)
+    2. Split the image into an even grid of ~tileSize tiles. For each tile, the mean and
+       stddev over a windowSize window centered on the tile are 4 integral lookups each,
+       so the cost does not depend on the window size
+    3. Tiles with enough contrast get a Sauvola threshold: mean * (1 + k * (stddev / 128 - 1))
+    4. Low-contrast tiles are either background or the inside of a large object.
+       A flat tile darker than an adjacent tile's threshold is object interior and inherits
+       that threshold (spreading through the object); the rest are background and keep
+       their own Sauvola value (stddev ~ 0 -> mean * (1 - k)), which never marks them
+    5. Per-pixel threshold = bilinear interpolation between the 4 nearest tile centers,
+       processed in parallel over tile rows
+*/
+Mat localThresholdImage(const Mat& input, int tileSize, int windowSize, double k) {
+  Mat gray;
+  blurredGray(input, gray, nullptr);
+
+  const int rows = gray.rows;
+  const int cols = gray.cols;
+  Mat binary(gray.size(), CV_8U);
+  if (gray.empty()) {
+    return binary;
   }
 
-  // manual thresholding loop
-  binary = Mat::zeros(gray.size(), CV_8U);
+  tileSize = max(tileSize, 8);
+  windowSize = max(windowSize, tileSize);
+
+  // integral images: any window sum is 4 lookups
+  Mat sum, sqsum;
+  cv::integral(gray, sum, sqsum, CV_32S, CV_64F);
+
+  // even tile grid covering the whole image
+  const int nx = max(1, cvRound((double)cols / tileSize));
+  const int ny = max(1, cvRound((double)rows / tileSize));
+  const float tileW = (float)cols / nx;
+  const float tileH = (float)rows / ny;
+  const float half = windowSize / 2.0f;
+  const double minContrast = 8.0; // stddev below this = flat tile
+  const double dynRange = 128.0;  // Sauvola R for 8-bit images
+
+  vector<float> tileMean(nx * ny), tileThresh(nx * ny);
+  vector<uchar> state(nx * ny); // 0 = flat, 1 = contrast, 2 = object interior
 
-  for (int r = 0; r < gray.rows; r++) {
-    for (int c = 0; c < gray.cols; c++) {
-      // compare pixel value to threshold
-      if (gray.at<uchar>(r, c) < threshValue) {
-        binary.at<uchar>(r, c) = 255;
+  // tile statistics, parallel over tile rows
+  parallelStripes(ny, [&](int tyBegin, int tyEnd) {
+    for (int ty = tyBegin; ty < tyEnd; ty++) {
+      float cy = (ty + 0.5f) * tileH;
+      int y0 = max(0, (int)(cy - half));
+      int y1 = min(rows, max(y0 + 1, (int)(cy + half)));
+      for (int tx = 0; tx < nx; tx++) {
+        float cx = (tx + 0.5f) * tileW;
+        int x0 = max(0, (int)(cx - half));
+        int x1 = min(cols, max(x0 + 1, (int)(cx + half)));
+
+        double n = (double)(x1 - x0) * (y1 - y0);
+        double s = (double)sum.at<int>(y1, x1) - sum.at<int>(y0, x1) - sum.at<int>(y1, x0) + sum.at<int>(y0, x0);
+        double sq = sqsum.at<double>(y1, x1) - sqsum.at<double>(y0, x1) - sqsum.at<double>(y1, x0) + sqsum.at<double>(y0, x0);
+        double mean = s / n;
+        double sd = std::sqrt(max(sq / n - mean * mean, 0.0));
+
+        int i = ty * nx + tx;
+        tileMean[i] = (float)mean;
+        tileThresh[i] = (float)(mean * (1.0 + k * (sd / dynRange - 1.0)));
+        state[i] = (sd >= minContrast) ? 1 : 0;
       }
-      else {
-        binary.at<uchar>(r, c) = 0;
+    }
+  }, 1);
+
+  // flat tiles darker than a neighbor's threshold are object interior: spread that threshold
+  vector<int> queue;
+  queue.reserve(nx * ny);
+  for (int i = 0; i < nx * ny; i++) {
+    if (state[i] == 1) queue.push_back(i);
+  }
+  for (size_t q = 0; q < queue.size(); q++) {
+    int i = queue[q];
+    int tx = i % nx, ty = i / nx;
+    const int nbr[4][2] = { { tx - 1, ty }, { tx + 1, ty }, { tx, ty - 1 }, { tx, ty + 1 } };
+    for (const auto& p : nbr) {
+      if (p[0] < 0 || p[0] >= nx || p[1] < 0 || p[1] >= ny) continue;
+      int j = p[1] * nx + p[0];
+      if (state[j] == 0 && tileMean[j] < tileThresh[i]) {
+        tileThresh[j] = tileThresh[i];
+        state[j] = 2;
+        queue.push_back(j);
       }
     }
   }
 
+  // horizontal interpolation index/weight per column (shared by all rows)
+  vector<int> colTile0(cols), colTile1(cols);
+  vector<float> colWeight(cols);
+  for (int x = 0; x < cols; x++) {
+    float fx = (x + 0.5f) / tileW - 0.5f;
+    int t0 = std::clamp((int)floor(fx), 0, nx - 1);
+    colTile0[x] = t0;
+    colTile1[x] = min(t0 + 1, nx - 1);
+    colWeight[x] = std::clamp(fx - t0, 0.0f, 1.0f);
+  }
+
+  // bilinear per-pixel threshold + compare, parallel over tile rows
+  parallelStripes(ny, [&](int tyBegin, int tyEnd) {
+    vector<float> rowThresh(nx);
+    for (int ty = tyBegin; ty < tyEnd; ty++) {
+      int yStart = cvRound(ty * tileH);
+      int yEnd = (ty == ny - 1) ? rows : cvRound((ty + 1) * tileH);
+      for (int y = yStart; y < yEnd; y++) {
+        // vertical interpolation of the tile thresholds for this row
+        float fy = (y + 0.5f) / tileH - 0.5f;
+        int t0 = std::clamp((int)floor(fy), 0, ny - 1);
+        int t1 = min(t0 + 1, ny - 1);
+        float wy = std::clamp(fy - t0, 0.0f, 1.0f);
+        for (int tx = 0; tx < nx; tx++) {
+          rowThresh[tx] = (1.0f - wy) * tileThresh[t0 * nx + tx] + wy * tileThresh[t1 * nx + tx];
+        }
+
+        const uchar* g = gray.ptr<uchar>(y);
+        uchar* dst = binary.ptr<uchar>(y);
+        for (int x = 0; x < cols; x++) {
+          float a = rowThresh[colTile0[x]];
+          float t = a + colWeight[x] * (rowThresh[colTile1[x]] - a);
+          dst[x] = (g[x] < t) ? 255 : 0;
+        }
+      }
+    }
+  }, 1);
+
   return binary;
-}
\ No newline at end of file
+}
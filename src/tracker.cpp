@@ -0,0 +1,230 @@
+/*
+  Parker Cai
+  February 19, 2026
+  CS5330 - Project 3: Real-time 2-D Object Recognition
+
+  Frame-to-frame region tracking (stable track IDs for segmentation colors)
+*/
+
+#include "or2d.h"
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+
+/*
+  Minimum-cost assignment (Hungarian / Kuhn-Munkres with potentials), O(n^2 m)
+
+  cost is n x m with n <= m, row-major. Returns for each row the column it is assigned to.
+*/
+static std::vector<int> hungarian(const std::vector<double>& cost, int n, int m) {
+  const double INF = std::numeric_limits<double>::infinity();
+  // 1-based potentials, column 0 is a virtual start column
+  std::vector<double> u(n + 1, 0.0), v(m + 1, 0.0);
+  std::vector<int> rowOfCol(m + 1, 0), way(m + 1, 0);
+
+  for (int i = 1; i <= n; i++) {
+    rowOfCol[0] = i;
+    int j0 = 0;
+    std::vector<double> minv(m + 1, INF);
+    std::vector<char> used(m + 1, 0);
+    do {
+      used[j0] = 1;
+      int i0 = rowOfCol[j0], j1 = 0;
+      double delta = INF;
+      for (int j = 1; j <= m; j++) {
+        if (used[j]) continue;
+        double cur = cost[(i0 - 1) * m + (j - 1)] - u[i0] - v[j];
+        if (cur < minv[j]) {
+          minv[j] = cur;
+          way[j] = j0;
+        }
+        if (minv[j] < delta) {
+          delta = minv[j];
+          j1 = j;
+        }
+      }
+      for (int j = 0; j <= m; j++) {
+        if (used[j]) {
+          u[rowOfCol[j]] += delta;
+          v[j] -= delta;
+        }
+        else {
+          minv[j] -= delta;
+        }
+      }
+      j0 = j1;
+    } while (rowOfCol[j0] != 0);
+    // walk the augmenting path back
+    do {
+      int j1 = way[j0];
+      rowOfCol[j0] = rowOfCol[j1];
+      j0 = j1;
+    } while (j0 != 0);
+  }
+
+  std::vector<int> colOfRow(n, -1);
+  for (int j = 1; j <= m; j++) {
+    if (rowOfCol[j] > 0) colOfRow[rowOfCol[j] - 1] = j - 1;
+  }
+  return colOfRow;
+}
+
+RegionTracker::RegionTracker(float maxMatchDist) : maxMatchDist(maxMatchDist) {}
+
+void RegionTracker::reset() {
+  tracks.clear();
+  nextId = 0;
+}
+
+/*
+  Match this frame's regions to the previous frame's tracks.
+
+  Cost = centroid distance, clamped at maxMatchDist: a pair that far apart costs the same
+  as leaving both unmatched, so the optimal assignment never prefers it, and it is
+  dropped afterwards. Matched regions keep their track ID, the rest start new tracks.
+  Tracks not seen in this frame end.
+*/
+void RegionTracker::update(std::vector<RegionInfo>& regions) {
+  const int numTracks = (int)tracks.size();
+  const int numRegions = (int)regions.size();
+  for (RegionInfo& region : regions) {
+    region.trackId = -1;
+  }
+
+  if (numTracks > 0 && numRegions > 0) {
+    // the solver wants rows <= columns: put the smaller side on the rows
+    const bool tracksOnRows = numTracks <= numRegions;
+    const int n = tracksOnRows ? numTracks : numRegions;
+    const int m = tracksOnRows ? numRegions : numTracks;
+    std::vector<double> cost((size_t)n * m);
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; j < m; j++) {
+        const Track& t = tracks[tracksOnRows ? i : j];
+        const RegionInfo& r = regions[tracksOnRows ? j : i];
+        double dx = r.centroid.x - t.centroid.x;
+        double dy = r.centroid.y - t.centroid.y;
+        cost[(size_t)i * m + j] = std::min(std::sqrt(dx * dx + dy * dy), (double)maxMatchDist);
+      }
+    }
+
+    std::vector<int> match = hungarian(cost, n, m);
+    for (int i = 0; i < n; i++) {
+      int j = match[i];
+      if (j < 0 || cost[(size_t)i * m + j] >= maxMatchDist) continue; // outside the gate
+      int t = tracksOnRows ? i : j;
+      int r = tracksOnRows ? j : i;
+      regions[r].trackId = tracks[t].id;
+    }
+  }
+
+  // new tracks for unmatched regions, in the order given (largest first)
+  tracks.clear();
+  for (RegionInfo& region : regions) {
+    if (region.trackId < 0) {
+      region.trackId = nextId++;
+    }
+    tracks.push_back({ region.trackId, region.centroid });
+  }
+}
+
+
+/*
+  Track cache lookup
+
+  A region hits when its track has an entry that has not been reused refreshFrames times
+  yet, and its area, centroid and orientation (from the moments accumulated while labeling)
+  are all within tolerance. The cached features, OBB, embedding and class ids are copied
+  in; the OBB is shifted by the centroid movement so the overlay stays on the object.
+*/
+int TrackCache::lookup(std::vector<RegionInfo>& regions) {
+  int hits = 0;
+  for (RegionInfo& region : regions) {
+    region.cached = false;
+    if (region.trackId < 0 || region.moments.m00 <= 0) continue;
+
+    auto it = std::find_if(entries.begin(), entries.end(),
+      [&](const Entry& e) { return e.region.trackId == region.trackId; });
+    if (it == entries.end() || it->reuses >= refreshFrames) continue;
+    const RegionInfo& c = it->region;
+
+    // orientation of the axis of least central moment, same formula as computeRegionFeatures
+    float theta = 0.5f * static_cast<float>(std::atan2(2.0 * region.moments.mu11,
+      region.moments.mu20 - region.moments.mu02));
+    float dTheta = std::abs(theta - c.theta);
+    dTheta = std::min(dTheta, static_cast<float>(CV_PI) - dTheta); // an axis, not a direction
+    float dx = region.centroid.x - c.centroid.x;
+    float dy = region.centroid.y - c.centroid.y;
+    if (std::abs(region.area - c.area) > areaTol * c.area ||
+      dx * dx + dy * dy > centroidTol * centroidTol ||
+      dTheta > thetaTol) {
+      continue;
+    }
+
+    region.theta = c.theta;
+    region.orientedBBox = c.orientedBBox;
+    region.orientedBBox.center += cv::Point2f(dx, dy);
+    region.bboxRatio = c.bboxRatio;
+    region.percentFilled = c.percentFilled;
+    std::copy(c.huMoments, c.huMoments + 7, region.huMoments);
+    region.featureVector = c.featureVector;
+    region.uMin = c.uMin;
+    region.uMax = c.uMax;
+    region.vMin = c.vMin;
+    region.vMax = c.vMax;
+    region.embeddingVector = c.embeddingVector;
+    region.classId = c.classId;
+    region.classConfidence = c.classConfidence;
+    region.cnnClassId = c.cnnClassId;
+    region.cnnConfidence = c.cnnConfidence;
+    region.cached = true;
+    it->reuses++;
+    hits++;
+  }
+  return hits;
+}
+
+/*
+  Track cache update, after features/embeddings/classification for the frame
+
+  Recomputed regions replace their entry (reuse count back to 0). Cached regions keep the
+  entry they came from, but pick up class ids computed this frame.
+*/
+void TrackCache::store(const std::vector<RegionInfo>& regions) {
+  std::vector<Entry> next;
+  next.reserve(regions.size());
+  for (const RegionInfo& region : regions) {
+    if (region.trackId < 0) continue;
+    auto it = std::find_if(entries.begin(), entries.end(),
+      [&](const Entry& e) { return e.region.trackId == region.trackId; });
+
+    if (region.cached && it != entries.end()) {
+      Entry e = std::move(*it);
+      e.region.classId = region.classId;
+      e.region.classConfidence = region.classConfidence;
+      e.region.cnnClassId = region.cnnClassId;
+      e.region.cnnConfidence = region.cnnConfidence;
+      e.region.embeddingVector = region.embeddingVector; // may have arrived from the embedding worker
+      next.push_back(std::move(e));
+    }
+    else {
+      Entry e{ region, 0 };
+      e.region.runs.clear(); // not needed for lookups
+      next.push_back(std::move(e));
+    }
+  }
+  entries = std::move(next);
+}
+
+void TrackCache::clear() {
+  entries.clear();
+}
+
+void TrackCache::clearLabels() {
+  for (Entry& e : entries) {
+    e.region.classId = LABEL_NONE;
+    e.region.cnnClassId = LABEL_NONE;
+  }
+}
@@ -10,6 +10,8 @@
 #include "or2d.h"
 #include <opencv2/opencv.hpp>
 #include <fstream>
+#include <iomanip>
+#include <limits>
 #include <vector>
 #include <string>
 #include <print>
@@ -112,7 +114,8 @@ void saveTrainingExample(const std::string& filename,
     std::println("Error: can't open {}", filename);
     return;
   }
-  file << label;
+  // lossless, so the HNSW / PQ files built from these values still match the CSV on reload
+  file << label << std::setprecision(std::numeric_limits<float>::max_digits10);
   for (const float& f : features) {
     file << "," << f;
   }
@@ -158,4 +161,36 @@ int loadTrainingData(const std::string& filename,
   }
   std::println("Loaded {} examples", labels.size());
   return labels.size();
+}
+
+/*
+  Class name dictionary: ids 0 and 1 are always the two "unknown" results
+*/
+LabelDictionary::LabelDictionary() {
+  intern("unknown"); // LABEL_UNKNOWN
+  intern("UNKNOWN"); // LABEL_REJECTED
+}
+
+int LabelDictionary::intern(const std::string& name) {
+  auto it = ids.find(name);
+  if (it != ids.end()) return it->second;
+  int id = (int)names.size();
+  names.push_back(name);
+  ids.emplace(name, id);
+  return id;
+}
+
+int LabelDictionary::find(const std::string& name) const {
+  auto it = ids.find(name);
+  return it == ids.end() ? LABEL_NONE : it->second;
+}
+
+const std::string& LabelDictionary::name(int id) const {
+  static const std::string none;
+  return (id < 0 || id >= (int)names.size()) ? none : names[id];
+}
+
+LabelDictionary& classLabels() {
+  static LabelDictionary dict;
+  return dict;
 }
\ No newline at end of file
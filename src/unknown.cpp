@@ -21,32 +21,45 @@ bool isUnknownObject(const std::vector<double>& query,
                      const std::vector<std::string>& train_labels,
                      const std::vector<std::vector<double>>& train_features,
                      double threshold) {
-    if(train_labels.empty()) {
+    return isUnknownObject(query, FeatureIndex(train_labels, train_features), threshold);
+}
+
+bool isUnknownObject(const std::vector<double>& query,
+                     const FeatureIndex& index,
+                     double threshold) {
+    if(index.empty()) {
         return true;
     }
     
     double conf;
-    classifyObject(query, train_labels, train_features, conf);
+    index.classify(query, conf);
     
     // low confidence = unknown
     return conf < threshold;
 }
 
-//Classify but return "UNKNOWN" if confidence too low
-std::string classifyWithUnknown(const std::vector<double>& query,
-                                const std::vector<std::string>& train_labels,
-                                const std::vector<std::vector<double>>& train_features,
-                                double& confidence,
-                                double threshold) {
-    if(train_labels.empty()) {
+//Classify but return "UNKNOWN" (LABEL_REJECTED) if confidence too low
+int classifyWithUnknown(const std::vector<double>& query,
+                        const std::vector<std::string>& train_labels,
+                        const std::vector<std::vector<double>>& train_features,
+                        double& confidence,
+                        double threshold) {
+    return classifyWithUnknown(query, FeatureIndex(train_labels, train_features), confidence, threshold);
+}
+
+int classifyWithUnknown(const std::vector<double>& query,
+                        const FeatureIndex& index,
+                        double& confidence,
+                        double threshold) {
+    if(index.empty()) {
         confidence = 0.0;
-        return "UNKNOWN";
+        return LABEL_REJECTED;
     }
     
-    std::string label = classifyObject(query, train_labels, train_features, confidence);
+    int label = index.classify(query, confidence);
     
     if(confidence < threshold) {
-        return "UNKNOWN";
+        return LABEL_REJECTED;
     }
     
     return label;
@@ -58,19 +71,27 @@ void classifyAndLabelWithUnknown(cv::Mat& image,
                                  const std::vector<std::string>& train_labels,
                                  const std::vector<std::vector<double>>& train_features,
                                  double threshold) {
-    if(train_labels.empty()) {
+    classifyAndLabelWithUnknown(image, regions, FeatureIndex(train_labels, train_features), threshold);
+}
+
+void classifyAndLabelWithUnknown(cv::Mat& image,
+                                 std::vector<RegionInfo>& regions,
+                                 const FeatureIndex& index,
+                                 double threshold) {
+    if(index.empty()) {
         cv::putText(image, "No training data", cv::Point(10, 60),
                    cv::FONT_HERSHEY_SIMPLEX, 0.7, cv::Scalar(0, 0, 255), 2);
         return;
     }
     
     for(auto& region : regions) {
-        double conf;
-        std::string label = classifyWithUnknown(region.featureVector, 
-                                                train_labels, 
-                                                train_features,
-                                                conf,
-                                                threshold);
+        // nearest neighbor once per region (a track cache hit already has it),
+        // then the same confidence test as classifyWithUnknown()
+        if(region.classId == LABEL_NONE) {
+            region.classId = index.classify(region.featureVector, region.classConfidence);
+        }
+        double conf = region.classConfidence;
+        int label = (conf < threshold) ? LABEL_REJECTED : region.classId;
         
         int x = (int)region.centroid.x - 40;
         int y = (int)region.centroid.y - 50;
@@ -79,14 +100,14 @@ void classifyAndLabelWithUnknown(cv::Mat& image,
         
         // pick color
         cv::Scalar color;
-        if(label == "UNKNOWN") {
+        if(label == LABEL_REJECTED) {
             color = cv::Scalar(0, 0, 255);  // red
         } else {
             color = cv::Scalar(255, 255, 0);  // yellow
         }
         
         // draw label
-        cv::putText(image, label, cv::Point(x, y),
+        cv::putText(image, classLabels().name(label), cv::Point(x, y),
                    cv::FONT_HERSHEY_SIMPLEX, 0.8, color, 2);
         
         // draw confidence
@@ -50,6 +50,63 @@ int getEmbedding(cv::Mat& src, cv::Mat& embedding, cv::dnn::Net& net, int debug)
 }
 
 
+/*
+  Batched version of getEmbedding: one blob with a row per image, one forward pass.
+
+  std::vector<cv::Mat> srcs  the images (8UC3), each resized to the network input size
+  cv::Mat embeddings          holds one embedding per row after the function returns
+  cv::dnn::Net net            a pre-trained ResNet 18 network
+  int debug                   1: print the embeddings, 0: don't show extra info
+ */
+
+int getEmbeddings(const std::vector<cv::Mat>& srcs, cv::Mat& embeddings, cv::dnn::Net& net, int debug) {
+  const int ORNet_size = 224; // expected network input size
+  const int n = (int)srcs.size();
+  if (n == 0) {
+    embeddings.release();
+    return(0);
+  }
+
+  // same preprocessing as getEmbedding, the resize happens per image inside blobFromImages
+  cv::Mat blob;
+  cv::dnn::blobFromImages(srcs, // input images
+    blob, // output array, N x 3 x 224 x 224
+    (1.0 / 255.0) * (1 / 0.226), // scale factor
+    cv::Size(ORNet_size, ORNet_size), // resize the images to this
+    cv::Scalar(124, 116, 104),   // subtract mean prior to scaling
+    true, // swapRB
+    false,  // center crop after scaling short side to size
+    CV_32F); // output depth/type
+
+  cv::Mat out;
+  try {
+    net.setInput(blob);
+    out = net.forward("onnx_node!resnetv22_flatten0_reshape0");
+  } catch (const cv::Exception&) {
+    out.release();
+  }
+
+  if (out.rows == n) {
+    embeddings = out.reshape(1, n).clone();
+  }
+  else {
+    // model exported with a fixed batch size of 1: one pass per image
+    embeddings.release();
+    for (int i = 0; i < n; i++) {
+      cv::Mat img = srcs[i];
+      cv::Mat one;
+      getEmbedding(img, one, net, 0);
+      embeddings.push_back(one.reshape(1, 1));
+    }
+  }
+
+  if (debug) {
+    std::cout << embeddings << std::endl;
+  }
+
+  return(0);
+}
+
 /*
   Given the oriented bounding box information, extracts the region
   from the original image and rotates it so the primary axis is
@@ -129,3 +186,65 @@ void prepEmbeddingImage(cv::Mat& frame, cv::Mat& embImg, int cx, int cy, float t
 
   return;
 }
+
+
+/*
+  Fused version of prepEmbeddingImage for the per-frame path.
+
+  prepEmbeddingImage rotates the whole frame into a 1.414*max(w,h) square,
+  crops the ROI and getEmbedding then resizes it to 224x224. Here the three
+  steps are one affine matrix A = S * (R - T):
+    R  rotation by -theta about (cx, cy), as in prepEmbeddingImage
+    T  shift of the (clamped) ROI corner to the origin
+    S  ROI -> size x size scale, with the same pixel-center alignment as cv::resize
+  and the frame is warped directly into the size x size output.
+*/
+
+void prepEmbeddingInput(const cv::Mat& frame, cv::Mat& embImg, int cx, int cy, float theta, float minE1, float maxE1, float minE2, float maxE2, int size) {
+
+  // same ROI (and clamping against the rotated canvas) as prepEmbeddingImage
+  int largest = frame.cols > frame.rows ? frame.cols : frame.rows;
+  largest = (int)(1.414 * largest);
+
+  int left = cx + (int)minE1;
+  int top = cy - (int)maxE2;
+  int width = (int)maxE1 - (int)minE1;
+  int height = (int)maxE2 - (int)minE2;
+
+  if (left < 0) {
+    width += left;
+    left = 0;
+  }
+  if (top < 0) {
+    height += top;
+    top = 0;
+  }
+  if (left + width >= largest) {
+    width = (largest - 1) - left;
+  }
+  if (top + height >= largest) {
+    height = (largest - 1) - top;
+  }
+
+  if (width <= 0 || height <= 0) {
+    embImg.release();
+    return;
+  }
+
+  cv::Mat R = cv::getRotationMatrix2D(cv::Point2f((float)cx, (float)cy), -theta * 180.0 / CV_PI, 1.0);
+
+  // crop + scale: dst = (src - corner + 0.5) * s - 0.5
+  const double sx = (double)size / width;
+  const double sy = (double)size / height;
+  cv::Mat A(2, 3, CV_64F);
+  A.at<double>(0, 0) = sx * R.at<double>(0, 0);
+  A.at<double>(0, 1) = sx * R.at<double>(0, 1);
+  A.at<double>(0, 2) = sx * (R.at<double>(0, 2) - left + 0.5) - 0.5;
+  A.at<double>(1, 0) = sy * R.at<double>(1, 0);
+  A.at<double>(1, 1) = sy * R.at<double>(1, 1);
+  A.at<double>(1, 2) = sy * (R.at<double>(1, 2) - top + 0.5) - 0.5;
+
+  cv::warpAffine(frame, embImg, A, cv::Size(size, size), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+
+  return;
+}